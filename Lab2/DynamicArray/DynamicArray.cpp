@@ -1,11 +1,260 @@
 ﻿#include "DynamicArray.h"
 
+// Types whose objects can be moved to another address with a plain byte copy,
+// after which the old bytes are simply dropped (no destructor call). Array
+// shifts and regrows these with memmove/realloc instead of element by element.
+// Trivially copyable types qualify; specialize for your own types to opt in.
 template<typename T>
-class Array final {
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+// Default allocator of Array: the C heap. Besides the std::allocator
+// interface it offers reallocate, which Array uses to regrow trivially
+// relocatable elements through realloc.
+template<typename T>
+struct MallocAllocator {
+    using value_type = T;
+
+    MallocAllocator() = default;
+    template<typename U>
+    MallocAllocator(const MallocAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t count) {
+        void* block = std::malloc(sizeof(T) * count);
+        if (!block) throw std::bad_alloc();
+        return static_cast<T*>(block);
+    }
+
+    void deallocate(T* block, std::size_t) noexcept {
+        std::free(block);
+    }
+
+    // Resize a block of trivially relocatable objects, in place when the heap
+    // can. The old block stays valid if this throws.
+    T* reallocate(T* block, std::size_t, std::size_t count) {
+        void* resized = std::realloc(static_cast<void*>(block), sizeof(T) * count);
+        if (!resized) throw std::bad_alloc();
+        return static_cast<T*>(resized);
+    }
+
+    template<typename U>
+    bool operator==(const MallocAllocator<U>&) const noexcept { return true; }
+    template<typename U>
+    bool operator!=(const MallocAllocator<U>&) const noexcept { return false; }
+};
+
+template<typename A, typename = void>
+struct has_reallocate : std::false_type {};
+
+template<typename A>
+struct has_reallocate<A, std::void_t<decltype(std::declval<A&>().reallocate(
+    std::declval<typename A::value_type*>(), std::size_t(), std::size_t()))>> : std::true_type {};
+
+// Bump-pointer memory resource. Each allocation takes the next aligned bytes
+// of the current chunk and deallocate does nothing; all memory goes back at
+// once in release() or the destructor. Chunks come from the upstream resource
+// and double in size, so a request-scoped arena talks to upstream only a few
+// times. Not thread-safe.
+class ArenaResource final : public std::pmr::memory_resource {
+public:
+    explicit ArenaResource(std::size_t initialChunkSize = kDefaultChunkSize,
+        std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : m_upstream(upstream), m_nextChunkSize(std::max<std::size_t>(initialChunkSize, sizeof(Chunk) + 1)) {
+    }
+
+    ArenaResource(const ArenaResource&) = delete;
+    ArenaResource& operator=(const ArenaResource&) = delete;
+
+    ~ArenaResource() override {
+        release();
+    }
+
+    // Give every chunk back to upstream. Memory handed out before is invalid.
+    void release() {
+        while (m_chunks) {
+            Chunk* next = m_chunks->next;
+            m_upstream->deallocate(m_chunks, m_chunks->size, alignof(std::max_align_t));
+            m_chunks = next;
+        }
+        m_current = m_end = nullptr;
+    }
+
+    std::pmr::memory_resource* upstream() const { return m_upstream; }
+
+private:
+    static constexpr std::size_t kDefaultChunkSize = 4096;
+
+    struct Chunk {
+        Chunk* next;
+        std::size_t size;
+    };
+
+    std::pmr::memory_resource* m_upstream;
+    std::size_t m_nextChunkSize;
+    Chunk* m_chunks = nullptr;
+    char* m_current = nullptr;
+    char* m_end = nullptr;
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        void* position = m_current;
+        std::size_t space = m_end - m_current;
+        if (!m_current || !std::align(alignment, bytes, position, space)) {
+            // the chunk header keeps max_align_t alignment for what follows it
+            const std::size_t header = (sizeof(Chunk) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+            std::size_t size = m_nextChunkSize;
+            while (size < header + bytes + alignment) size *= 2;
+            Chunk* chunk = static_cast<Chunk*>(m_upstream->allocate(size, alignof(std::max_align_t)));
+            chunk->next = m_chunks;
+            chunk->size = size;
+            m_chunks = chunk;
+            m_nextChunkSize = size * 2;
+            m_current = reinterpret_cast<char*>(chunk) + header;
+            m_end = reinterpret_cast<char*>(chunk) + size;
+
+            position = m_current;
+            space = m_end - m_current;
+            std::align(alignment, bytes, position, space);
+        }
+        m_current = static_cast<char*>(position) + bytes;
+        return position;
+    }
+
+    void do_deallocate(void*, std::size_t, std::size_t) override {
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// Size-class pool resource. Requests of up to kMaxPooledSize bytes are rounded
+// up to a power of two from kMinBlockSize and served from a free list per
+// class, refilled a chunk at a time from upstream; freed blocks go back to
+// their list for reuse. Larger or over-aligned requests go straight to
+// upstream and must be deallocated. release() or the destructor gives every
+// chunk back. Not thread-safe.
+class PoolResource final : public std::pmr::memory_resource {
+public:
+    static constexpr std::size_t kMinBlockSize = 16;
+    static constexpr std::size_t kMaxPooledSize = 4096;
+
+    explicit PoolResource(std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : m_upstream(upstream) {
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource() override {
+        release();
+    }
+
+    // Give every chunk back to upstream. Pooled blocks handed out before are invalid.
+    void release() {
+        while (m_chunks) {
+            Chunk* next = m_chunks->next;
+            m_upstream->deallocate(m_chunks, kChunkSize, alignof(std::max_align_t));
+            m_chunks = next;
+        }
+        std::fill(std::begin(m_free), std::end(m_free), nullptr);
+    }
+
+    std::pmr::memory_resource* upstream() const { return m_upstream; }
+
+private:
+    static constexpr std::size_t kClasses = 9;
+    static constexpr std::size_t kChunkSize = 64 * 1024;
+    // blocks start this far into a chunk, so they are aligned to min(size, max_align_t)
+    static constexpr std::size_t kChunkHeader = alignof(std::max_align_t) > 16 ? alignof(std::max_align_t) : 16;
+
+    struct Chunk {
+        Chunk* next;
+    };
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    std::pmr::memory_resource* m_upstream;
+    Chunk* m_chunks = nullptr;
+    FreeBlock* m_free[kClasses] = {};
+
+    static bool pooled(std::size_t bytes, std::size_t alignment) {
+        return bytes <= kMaxPooledSize && alignment <= alignof(std::max_align_t);
+    }
+
+    static std::size_t sizeClass(std::size_t bytes) {
+        std::size_t index = 0;
+        while ((kMinBlockSize << index) < bytes) ++index;
+        return index;
+    }
+
+    void refill(std::size_t index) {
+        const std::size_t blockSize = kMinBlockSize << index;
+        Chunk* chunk = static_cast<Chunk*>(m_upstream->allocate(kChunkSize, alignof(std::max_align_t)));
+        chunk->next = m_chunks;
+        m_chunks = chunk;
+        char* first = reinterpret_cast<char*>(chunk) + kChunkHeader;
+        const std::size_t count = (kChunkSize - kChunkHeader) / blockSize;
+        // thread the list front to back so blocks are handed out in address order
+        for (std::size_t i = count; i-- > 0;) {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(first + i * blockSize);
+            block->next = m_free[index];
+            m_free[index] = block;
+        }
+    }
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        if (!pooled(bytes, alignment)) return m_upstream->allocate(bytes, alignment);
+        const std::size_t index = sizeClass(bytes);
+        if (!m_free[index]) refill(index);
+        FreeBlock* block = m_free[index];
+        m_free[index] = block->next;
+        return block;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        if (!pooled(bytes, alignment)) {
+            m_upstream->deallocate(p, bytes, alignment);
+            return;
+        }
+        const std::size_t index = sizeClass(bytes);
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        block->next = m_free[index];
+        m_free[index] = block;
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// Uninitialized room for N elements inside the owning object.
+template<typename T, int N>
+struct InlineStorage {
+    alignas(T) unsigned char m_inline[sizeof(T) * N];
+    T* inlineData() { return reinterpret_cast<T*>(m_inline); }
+};
+
+template<typename T>
+struct InlineStorage<T, 0> {
+    T* inlineData() { return nullptr; }
+};
+
+// Growable array of T. Storage comes from Allocator, any std::allocator-style
+// allocator; PmrArray takes its memory from a std::pmr::memory_resource.
+// With InlineCapacity > 0 (see SmallArray) the first InlineCapacity elements
+// live inside the object and the allocator is only used past them.
+template<typename T, typename Allocator = MallocAllocator<T>, int InlineCapacity = 0>
+class Array final : private InlineStorage<T, InlineCapacity> {
+    static_assert(std::is_same<typename Allocator::value_type, T>::value, "Allocator must allocate T");
+    static_assert(InlineCapacity >= 0, "InlineCapacity can't be negative");
+    using AllocTraits = std::allocator_traits<Allocator>;
+    using InlineStorage<T, InlineCapacity>::inlineData;
+
 public:
     class Iterator {
     public:
-        Iterator(Array<T>* array = nullptr, int pos = 0, bool rev = false)
+        Iterator(Array* array = nullptr, int pos = 0, bool rev = false)
             : m_array(array), m_pos(pos), m_rev(rev) {
         }
         const T& get() const { return m_array->m_data[m_pos]; }
@@ -16,14 +265,14 @@ public:
             return m_rev ? (m_pos >= 0) : (m_pos < m_array->m_size);
         }
     private:
-        Array<T>* m_array;
+        Array* m_array;
         int m_pos;
         bool m_rev;
     };
 
     class ConstIterator {
     public:
-        ConstIterator(const Array<T>* array = nullptr, int pos = 0, bool rev = false)
+        ConstIterator(const Array* array = nullptr, int pos = 0, bool rev = false)
             : m_array(array), m_pos(pos), m_rev(rev) {
         }
         const T& get() const { return m_array->m_data[m_pos]; }
@@ -33,95 +282,248 @@ public:
             return m_rev ? (m_pos >= 0) : (m_pos < m_array->m_size);
         }
     private:
-        const Array<T>* m_array;
+        const Array* m_array;
         int m_pos;
         bool m_rev;
     };
 
-    Array() : m_size(0), m_capacity(kDefaultCapacity), m_data(nullptr) {
-        allocate(m_capacity);
+    Array() : Array(kDefaultCapacity, Allocator()) {
+    }
+
+    explicit Array(int capacity) : Array(capacity, Allocator()) {
+    }
+
+    explicit Array(const Allocator& alloc) : Array(kDefaultCapacity, alloc) {
     }
 
-    explicit Array(int capacity) : m_size(0), m_capacity(capacity), m_data(nullptr) {
-        if (m_capacity <= 0) m_capacity = kDefaultCapacity;
-        allocate(m_capacity);
+    Array(int capacity, const Allocator& alloc) : m_size(0), m_capacity(0), m_data(nullptr), m_alloc(alloc) {
+        allocate(capacity > 0 ? capacity : kDefaultCapacity);
     }
 
     ~Array() {
         clearElements();
-        free(m_data);
+        deallocate();
     }
 
     // Copy constructor
-    Array(const Array& other) : m_size(0), m_capacity(other.m_capacity), m_data(nullptr) {
-        allocate(m_capacity);
-        for (int i = 0; i < other.m_size; ++i) {
-            new (&m_data[i]) T(other.m_data[i]);
-            ++m_size;
+    Array(const Array& other) : Array(other, AllocTraits::select_on_container_copy_construction(other.m_alloc)) {
+    }
+
+    Array(const Array& other, const Allocator& alloc) : m_size(0), m_capacity(0), m_data(nullptr), m_alloc(alloc) {
+        allocate(std::max(other.m_capacity, 1));
+        try {
+            for (int i = 0; i < other.m_size; ++i) {
+                new (&m_data[i]) T(other.m_data[i]);
+                ++m_size;
+            }
+        }
+        catch (...) {
+            clearElements();
+            deallocate();
+            throw;
         }
     }
         
     // Move constructor
-    Array(Array&& other) noexcept : m_size(other.m_size), m_capacity(other.m_capacity), m_data(other.m_data) {
-        other.m_data = nullptr;
-        other.m_size = 0;
-        other.m_capacity = 0;
+    // Inline elements can't change owner and are moved one by one
+    Array(Array&& other) noexcept(InlineCapacity == 0 || std::is_nothrow_move_constructible<T>::value)
+        : m_size(0), m_capacity(0), m_data(nullptr), m_alloc(std::move(other.m_alloc)) {
+        takeStorage(other);
     }
 
-    Array& operator=(Array other) {
-        std::swap(m_data, other.m_data);
-        std::swap(m_size, other.m_size);
-        std::swap(m_capacity, other.m_capacity);
+    // Takes the storage when alloc can free it, moves the elements one by one otherwise
+    Array(Array&& other, const Allocator& alloc) : m_size(0), m_capacity(0), m_data(nullptr), m_alloc(alloc) {
+        if (m_alloc == other.m_alloc) {
+            takeStorage(other);
+            return;
+        }
+        allocate(std::max(other.m_size, 1));
+        try {
+            for (int i = 0; i < other.m_size; ++i) {
+                new (&m_data[i]) T(std::move_if_noexcept(other.m_data[i]));
+                ++m_size;
+            }
+        }
+        catch (...) {
+            clearElements();
+            deallocate();
+            throw;
+        }
+    }
+
+    // An array keeps its allocator unless the allocator type says it propagates,
+    // so arena-backed arrays stay in their arena whatever is assigned to them
+    Array& operator=(const Array& other) {
+        if (this == &other) return *this;
+        if constexpr (AllocTraits::propagate_on_container_copy_assignment::value) {
+            Array copy(other, other.m_alloc);
+            clearElements();
+            deallocate();
+            m_alloc = copy.m_alloc;
+            takeStorage(copy);
+        }
+        else {
+            Array copy(other, m_alloc);
+            clearElements();
+            deallocate();
+            takeStorage(copy);
+        }
+        return *this;
+    }
+
+    // Inline elements are moved one by one, so that move can throw whatever the allocator
+    Array& operator=(Array&& other) noexcept((InlineCapacity == 0 || std::is_nothrow_move_constructible<T>::value) &&
+        (AllocTraits::propagate_on_container_move_assignment::value || AllocTraits::is_always_equal::value)) {
+        if (this == &other) return *this;
+        if constexpr (AllocTraits::propagate_on_container_move_assignment::value) {
+            clearElements();
+            deallocate();
+            m_alloc = std::move(other.m_alloc);
+            takeStorage(other);
+        }
+        else {
+            Array moved(std::move(other), m_alloc);
+            clearElements();
+            deallocate();
+            takeStorage(moved);
+        }
         return *this;
     }
 
+    Allocator get_allocator() const { return m_alloc; }
+
     // Insert at end
     int insert(const T& value) {
-        return insert(m_size, value);
+        return emplace_at(m_size, value);
+    }
+
+    int insert(T&& value) {
+        return insert(m_size, std::move(value));
     }
 
     int insert(int index, const T& value) {
-        if (m_size + 1 > m_capacity) {
-            grow();
+        return emplace_at(index, value);
+    }
+
+    int insert(int index, T&& value) {
+        if constexpr (std::is_move_constructible<T>::value) {
+            return emplace_at(index, std::move(value));
+        }
+        else {
+            return emplace_at(index, static_cast<const T&>(value));
         }
+    }
 
-        // shift to right starting from last to index
-        if (m_size > 0 && index < m_size) {
-            for (int i = m_size - 1; i >= index; --i) {
-                // move or copy element from i to i+1
-                if constexpr (std::is_move_constructible<T>::value) {
-                    new (&m_data[i + 1]) T(std::move(m_data[i]));
-                }
-                else {
-                    new (&m_data[i + 1]) T(m_data[i]);
-                }
-                m_data[i].~T();
+    // Construct an element from args at the end, returns its index
+    template<typename... Args>
+    int emplace(Args&&... args) {
+        return emplace_at(m_size, std::forward<Args>(args)...);
+    }
+
+    // Construct an element from args at index, returns index
+    template<typename... Args>
+    int emplace_at(int index, Args&&... args) {
+        assert(index >= 0 && index <= m_size);
+        if (index == m_size && m_size < m_capacity) {
+            new (&m_data[m_size]) T(std::forward<Args>(args)...);
+            ++m_size;
+            return index;
+        }
+
+        if constexpr (sizeof...(Args) == 1 && (std::is_same<std::decay_t<Args>, T>::value && ...)) {
+            // a T from outside the array can go straight into the gap
+            const T* source = std::addressof(args...);
+            if (std::less<const T*>()(source, m_data) || !std::less<const T*>()(source, m_data + m_size)) {
+                constructInGap(index, std::forward<Args>(args)...);
+                return index;
             }
-            new (&m_data[index]) T(value);
+        }
+
+        // args may refer to elements that the shift or regrowth is about to move
+        T value(std::forward<Args>(args)...);
+        if constexpr (std::is_move_constructible<T>::value) {
+            constructInGap(index, std::move(value));
         }
         else {
-            new (&m_data[m_size]) T(value);
+            constructInGap(index, static_cast<const T&>(value));
         }
-        ++m_size;
         return index;
     }
 
-    void remove(int index) {
-        m_data[index].~T();
+    // Append [first, last)
+    template<typename It>
+    int append(It first, It last) {
+        return insert_range(m_size, first, last);
+    }
 
-        // shift left
-        for (int i = index; i < m_size - 1; ++i) {
-            if constexpr (std::is_move_constructible<T>::value) {
-                new (&m_data[i]) T(std::move(m_data[i + 1]));
+    // Insert [first, last) before index with a single shift of the tail and at
+    // most one regrowth, returns index
+    template<typename It>
+    int insert_range(int index, It first, It last) {
+        assert(index >= 0 && index <= m_size);
+        using Category = typename std::iterator_traits<It>::iterator_category;
+        if constexpr (!std::is_base_of<std::forward_iterator_tag, Category>::value) {
+            // single pass input: append, then rotate into place
+            const int oldSize = m_size;
+            for (; first != last; ++first) emplace(*first);
+            std::rotate(m_data + index, m_data + oldSize, m_data + m_size);
+            return index;
+        }
+        else {
+            if constexpr (std::is_pointer<It>::value) {
+                // a range out of this array moves with the shift, insert a copy of it
+                if (first != last && first >= m_data && first < m_data + m_size) {
+                    Array copy(static_cast<int>(last - first), m_alloc);
+                    copy.append(first, last);
+                    return insert_range(index, copy.m_data, copy.m_data + copy.m_size);
+                }
             }
-            else {
-                new (&m_data[i]) T(m_data[i + 1]);
+
+            const int count = static_cast<int>(std::distance(first, last));
+            if (count == 0) return index;
+            openGap(index, count);
+            int built = 0;
+            try {
+                for (; built < count; ++built, ++first) {
+                    new (&m_data[index + built]) T(*first);
+                }
+            }
+            catch (...) {
+                for (int i = 0; i < built; ++i) m_data[index + i].~T();
+                closeGap(index, count);
+                throw;
             }
-            m_data[i + 1].~T();
+            m_size += count;
+            return index;
         }
-        --m_size;
     }
 
+    void remove(int index) {
+        erase_range(index, index + 1);
+    }
+
+    // Remove the elements [first, last) with a single shift of the tail
+    void erase_range(int first, int last) {
+        assert(first >= 0 && first <= last && last <= m_size);
+        if (first == last) return;
+        for (int i = first; i < last; ++i) m_data[i].~T();
+        shiftLeft(first, last - first, m_size);
+        m_size -= last - first;
+    }
+
+    // Make room for at least capacity elements
+    void reserve(int capacity) {
+        if (capacity > m_capacity) reallocate(capacity, m_size, 0);
+    }
+
+    // Give unused capacity back, moving back inline when the elements fit
+    void shrink_to_fit() {
+        if (isInline() || m_capacity == std::max(m_size, 1)) return;
+        reallocate(std::max(m_size, 1), m_size, 0);
+    }
+
+    int capacity() const { return m_capacity; }
+
     const T& operator[](int index) const {
         assert(index >= 0 && index < m_size);
         return m_data[index];
@@ -140,43 +542,191 @@ public:
     Iterator reverseIterator() { return Iterator(this, m_size - 1, true); }
     ConstIterator reverseIterator() const { return ConstIterator(this, m_size - 1, true); }
 
+    // Contiguous iterators over the elements, for range-for and the standard
+    // and qs algorithms. Invalidated by insert and remove.
+    T* begin() { return m_data; }
+    T* end() { return m_data + m_size; }
+    const T* begin() const { return m_data; }
+    const T* end() const { return m_data + m_size; }
+
+    T* data() { return m_data; }
+    const T* data() const { return m_data; }
+
 private:
-    static constexpr int kDefaultCapacity = 8;
+    static constexpr int kDefaultCapacity = InlineCapacity > 0 ? InlineCapacity : 8;
     int m_size;
     int m_capacity;
     T* m_data;
+    Allocator m_alloc;
+
+    bool isInline() {
+        return InlineCapacity > 0 && m_data == inlineData();
+    }
 
+    // Storage for capacity elements while there is none, inline when it fits.
     void allocate(int capacity) {
-        void* block = std::malloc(sizeof(T) * capacity);
-        if (!block) throw std::bad_alloc();
-        m_data = reinterpret_cast<T*>(block);
+        if (capacity <= InlineCapacity) {
+            m_data = inlineData();
+            m_capacity = InlineCapacity;
+            return;
+        }
+        m_data = AllocTraits::allocate(m_alloc, capacity);
         m_capacity = capacity;
     }
 
-    void grow() {
-        int newCapacity = std::max(m_capacity + 1, static_cast<int>(std::ceil(m_capacity * 1.6)));
-        if (newCapacity <= m_capacity) newCapacity = m_capacity + 1;
+    void deallocate() {
+        if (m_data && !isInline()) AllocTraits::deallocate(m_alloc, m_data, m_capacity);
+        m_data = nullptr;
+        m_capacity = 0;
+    }
 
-        // allocate new block
-        void* block = std::malloc(sizeof(T) * newCapacity);
-        if (!block) throw std::bad_alloc();
-        
-        T* newData = reinterpret_cast<T*>(block);
-        // move or copy elements into new block
-        for (int i = 0; i < m_size; ++i) {
-            if constexpr (std::is_move_constructible<T>::value) {
-                new (&newData[i]) T(std::move(m_data[i]));
+    // Adopt the storage of other, whose allocator can free it, while this has
+    // none. Other is left empty.
+    void takeStorage(Array& other) {
+        if (other.isInline()) {
+            m_data = inlineData();
+            m_capacity = InlineCapacity;
+            if constexpr (is_trivially_relocatable<T>::value) {
+                std::memcpy(static_cast<void*>(m_data), static_cast<void*>(other.m_data), sizeof(T) * other.m_size);
+                m_size = other.m_size;
+                other.m_size = 0;
             }
             else {
-                new (&newData[i]) T(m_data[i]);
+                try {
+                    for (int i = 0; i < other.m_size; ++i) {
+                        new (&m_data[i]) T(std::move_if_noexcept(other.m_data[i]));
+                        ++m_size;
+                    }
+                }
+                catch (...) {
+                    clearElements();
+                    throw;
+                }
+                other.clearElements();
+            }
+            return;
+        }
+        m_data = other.m_data;
+        m_size = other.m_size;
+        m_capacity = other.m_capacity;
+        // back to the inline buffer, which is no storage at all without one
+        other.m_data = other.inlineData();
+        other.m_size = 0;
+        other.m_capacity = InlineCapacity;
+    }
+
+    // Move when T allows it, copy otherwise
+    static void moveConstruct(T* to, T& from) {
+        if constexpr (std::is_move_constructible<T>::value) {
+            new (to) T(std::move(from));
+        }
+        else {
+            new (to) T(from);
+        }
+    }
+
+    int nextCapacity(int needed) const {
+        const int grown = std::max(m_capacity + 1, static_cast<int>(std::ceil(m_capacity * 1.6)));
+        return std::max(needed, grown);
+    }
+
+    // Move the elements into a block of newCapacity, leaving gapCount
+    // unconstructed slots at gapIndex. Each element moves exactly once.
+    void reallocate(int newCapacity, int gapIndex, int gapCount) {
+        if constexpr (is_trivially_relocatable<T>::value && has_reallocate<Allocator>::value) {
+            // realloc can often extend the block in place, the old block stays valid on failure
+            if (!isInline() && newCapacity > InlineCapacity) {
+                m_data = m_alloc.reallocate(m_data, m_capacity, newCapacity);
+                m_capacity = newCapacity;
+                if (gapCount > 0) {
+                    std::memmove(static_cast<void*>(m_data + gapIndex + gapCount), static_cast<void*>(m_data + gapIndex), sizeof(T) * (m_size - gapIndex));
+                }
+                return;
+            }
+        }
+
+        // allocate new block, only shrink_to_fit asks for one that fits inline
+        T* newData;
+        if constexpr (InlineCapacity > 0) {
+            newData = newCapacity <= InlineCapacity ? inlineData() : AllocTraits::allocate(m_alloc, newCapacity);
+        }
+        else {
+            newData = AllocTraits::allocate(m_alloc, newCapacity);
+        }
+        if constexpr (is_trivially_relocatable<T>::value) {
+            if (gapIndex > 0) std::memcpy(static_cast<void*>(newData), static_cast<void*>(m_data), sizeof(T) * gapIndex);
+            if (m_size > gapIndex) {
+                std::memcpy(static_cast<void*>(newData + gapIndex + gapCount), static_cast<void*>(m_data + gapIndex), sizeof(T) * (m_size - gapIndex));
+            }
+        }
+        else {
+            // move or copy elements into new block
+            for (int i = 0; i < m_size; ++i) {
+                moveConstruct(&newData[i < gapIndex ? i : i + gapCount], m_data[i]);
+                m_data[i].~T();
             }
-            m_data[i].~T();
         }
 
         // free old block
-        std::free(m_data);
+        if (m_data && !isInline()) AllocTraits::deallocate(m_alloc, m_data, m_capacity);
         m_data = newData;
-        m_capacity = newCapacity;
+        m_capacity = std::max(newCapacity, InlineCapacity);
+    }
+
+    // Move [index, m_size) count slots right, into unconstructed storage
+    void shiftRight(int index, int count) {
+        if constexpr (is_trivially_relocatable<T>::value) {
+            std::memmove(static_cast<void*>(m_data + index + count), static_cast<void*>(m_data + index), sizeof(T) * (m_size - index));
+        }
+        else {
+            // shift to right starting from last to index
+            for (int i = m_size - 1; i >= index; --i) {
+                moveConstruct(&m_data[i + count], m_data[i]);
+                m_data[i].~T();
+            }
+        }
+    }
+
+    // Move [index + count, end) count slots left, over unconstructed storage
+    void shiftLeft(int index, int count, int end) {
+        if constexpr (is_trivially_relocatable<T>::value) {
+            std::memmove(static_cast<void*>(m_data + index), static_cast<void*>(m_data + index + count), sizeof(T) * (end - index - count));
+        }
+        else {
+            for (int i = index; i < end - count; ++i) {
+                moveConstruct(&m_data[i], m_data[i + count]);
+                m_data[i + count].~T();
+            }
+        }
+    }
+
+    // Make room for count elements at index: regrow once if needed, then the
+    // slots [index, index + count) are unconstructed. m_size is unchanged.
+    void openGap(int index, int count) {
+        if (m_size + count > m_capacity) {
+            reallocate(nextCapacity(m_size + count), index, count);
+        }
+        else {
+            shiftRight(index, count);
+        }
+    }
+
+    // Undo openGap after constructing into the gap failed
+    void closeGap(int index, int count) {
+        shiftLeft(index, count, m_size + count);
+    }
+
+    template<typename... Args>
+    void constructInGap(int index, Args&&... args) {
+        openGap(index, 1);
+        try {
+            new (&m_data[index]) T(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            closeGap(index, 1);
+            throw;
+        }
+        ++m_size;
     }
 
     void clearElements() {
@@ -186,3 +736,261 @@ private:
         m_size = 0;
     }
 };
+
+// Array whose storage comes from a std::pmr::memory_resource, such as an
+// ArenaResource or PoolResource.
+template<typename T>
+using PmrArray = Array<T, std::pmr::polymorphic_allocator<T>>;
+
+// Array that keeps up to N elements inside the object and only allocates
+// once it grows past them. Default construction never allocates.
+template<typename T, int N, typename Allocator = MallocAllocator<T>>
+using SmallArray = Array<T, Allocator, N>;
+
+// Tiered vector (Goodrich & Kloss): elements in blocks of BlockSize, each a
+// circular buffer, with every block full except the last. insert and remove
+// at a position shift within one block and then pass a single element
+// across each later block by moving that block's head, so they cost
+// O(BlockSize + size / BlockSize), O(sqrt(n)) for n near BlockSize^2.
+// operator[] is O(1) and scans walk whole blocks. Same interface as Array.
+template<typename T, int BlockSize = 1024>
+class TieredArray final {
+    static_assert(BlockSize > 0 && (BlockSize & (BlockSize - 1)) == 0, "BlockSize must be a power of two");
+
+public:
+    class Iterator {
+    public:
+        Iterator(TieredArray* array = nullptr, int pos = 0, bool rev = false)
+            : m_array(array), m_pos(pos), m_rev(rev) {
+        }
+        const T& get() const { return (*m_array)[m_pos]; }
+        void set(const T& value) { (*m_array)[m_pos] = value; }
+        void next() { if (m_rev) --m_pos; else ++m_pos; }
+        bool hasNext() const {
+            if (!m_array) return false;
+            return m_rev ? (m_pos >= 0) : (m_pos < m_array->m_size);
+        }
+    private:
+        TieredArray* m_array;
+        int m_pos;
+        bool m_rev;
+    };
+
+    class ConstIterator {
+    public:
+        ConstIterator(const TieredArray* array = nullptr, int pos = 0, bool rev = false)
+            : m_array(array), m_pos(pos), m_rev(rev) {
+        }
+        const T& get() const { return (*m_array)[m_pos]; }
+        void next() { if (m_rev) --m_pos; else ++m_pos; }
+        bool hasNext() const {
+            if (!m_array) return false;
+            return m_rev ? (m_pos >= 0) : (m_pos < m_array->m_size);
+        }
+    private:
+        const TieredArray* m_array;
+        int m_pos;
+        bool m_rev;
+    };
+
+    // Random-access iterator for range-for and the standard and qs algorithms.
+    // Invalidated by insert and remove.
+    template<bool Const>
+    class ElementIterator {
+    public:
+        using Container = std::conditional_t<Const, const TieredArray, TieredArray>;
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const T*, T*>;
+        using reference = std::conditional_t<Const, const T&, T&>;
+
+        ElementIterator(Container* array = nullptr, difference_type pos = 0) : m_array(array), m_pos(pos) {
+        }
+        operator ElementIterator<true>() const { return ElementIterator<true>(m_array, m_pos); }
+
+        reference operator*() const { return (*m_array)[static_cast<int>(m_pos)]; }
+        pointer operator->() const { return &**this; }
+        reference operator[](difference_type n) const { return *(*this + n); }
+
+        ElementIterator& operator++() { ++m_pos; return *this; }
+        ElementIterator operator++(int) { ElementIterator old = *this; ++m_pos; return old; }
+        ElementIterator& operator--() { --m_pos; return *this; }
+        ElementIterator operator--(int) { ElementIterator old = *this; --m_pos; return old; }
+        ElementIterator& operator+=(difference_type n) { m_pos += n; return *this; }
+        ElementIterator& operator-=(difference_type n) { m_pos -= n; return *this; }
+        friend ElementIterator operator+(ElementIterator it, difference_type n) { return it += n; }
+        friend ElementIterator operator+(difference_type n, ElementIterator it) { return it += n; }
+        friend ElementIterator operator-(ElementIterator it, difference_type n) { return it -= n; }
+        friend difference_type operator-(const ElementIterator& a, const ElementIterator& b) { return a.m_pos - b.m_pos; }
+
+        friend bool operator==(const ElementIterator& a, const ElementIterator& b) { return a.m_pos == b.m_pos; }
+        friend bool operator!=(const ElementIterator& a, const ElementIterator& b) { return a.m_pos != b.m_pos; }
+        friend bool operator<(const ElementIterator& a, const ElementIterator& b) { return a.m_pos < b.m_pos; }
+        friend bool operator>(const ElementIterator& a, const ElementIterator& b) { return a.m_pos > b.m_pos; }
+        friend bool operator<=(const ElementIterator& a, const ElementIterator& b) { return a.m_pos <= b.m_pos; }
+        friend bool operator>=(const ElementIterator& a, const ElementIterator& b) { return a.m_pos >= b.m_pos; }
+
+    private:
+        Container* m_array;
+        difference_type m_pos;
+    };
+
+    TieredArray() : m_size(0) {
+    }
+
+    ~TieredArray() {
+        clearElements();
+    }
+
+    // Copy constructor
+    TieredArray(const TieredArray& other) : TieredArray() {
+        for (int i = 0; i < other.m_size; ++i) insert(other[i]);
+    }
+
+    // Move constructor
+    TieredArray(TieredArray&& other) noexcept : m_size(other.m_size), m_blocks(std::move(other.m_blocks)) {
+        other.m_size = 0;
+    }
+
+    TieredArray& operator=(TieredArray other) {
+        std::swap(m_size, other.m_size);
+        std::swap(m_blocks, other.m_blocks);
+        return *this;
+    }
+
+    // Insert at end
+    int insert(const T& value) {
+        return insert(m_size, value);
+    }
+
+    int insert(int index, const T& value) {
+        assert(index >= 0 && index <= m_size);
+        // value may be an element that is about to move
+        T carry(value);
+        if (m_size == m_blocks.size() * BlockSize) addBlock();
+
+        const int first = index / BlockSize;
+        const int last = m_blocks.size() - 1;
+        int count = first == last ? m_size - first * BlockSize : BlockSize;
+        Block* block = &m_blocks[first];
+        int offset = index % BlockSize;
+
+        // a full block passes its last element on, the last block takes it in
+        for (int b = first; ; ++b) {
+            if (b == last) {
+                if (offset == 0 && count > 0) {
+                    // push front into the free slot before the head
+                    block->head = (block->head - 1) & kMask;
+                    new (&block->at(0)) T(std::move(carry));
+                }
+                else if (offset == count) {
+                    new (&block->at(count)) T(std::move(carry));
+                }
+                else {
+                    new (&block->at(count)) T(std::move(block->at(count - 1)));
+                    for (int k = count - 1; k > offset; --k) block->at(k) = std::move(block->at(k - 1));
+                    block->at(offset) = std::move(carry);
+                }
+                break;
+            }
+            if (b == first) {
+                T out(std::move(block->at(BlockSize - 1)));
+                for (int k = BlockSize - 1; k > offset; --k) block->at(k) = std::move(block->at(k - 1));
+                block->at(offset) = std::move(carry);
+                carry = std::move(out);
+            }
+            else {
+                // push front: the head steps back onto the slot of the outgoing last element
+                std::swap(carry, block->at(BlockSize - 1));
+                block->head = (block->head - 1) & kMask;
+            }
+            block = &m_blocks[b + 1];
+            count = b + 1 == last ? m_size - last * BlockSize : BlockSize;
+            offset = 0;
+        }
+        ++m_size;
+        return index;
+    }
+
+    void remove(int index) {
+        assert(index >= 0 && index < m_size);
+        const int first = index / BlockSize;
+        const int last = m_blocks.size() - 1;
+        Block* block = &m_blocks[first];
+        const int count = first == last ? m_size - first * BlockSize : BlockSize;
+
+        // close the gap inside the first block, its last slot is refilled from the next one
+        for (int k = index % BlockSize; k < count - 1; ++k) block->at(k) = std::move(block->at(k + 1));
+        if (first == last) block->at(count - 1).~T();
+        for (int b = first + 1; b <= last; ++b) {
+            Block& next = m_blocks[b];
+            block->at(BlockSize - 1) = std::move(next.at(0));
+            // pop front: the old head becomes the last slot, which only full blocks use
+            if (b == last) next.at(0).~T();
+            next.head = (next.head + 1) & kMask;
+            block = &next;
+        }
+        const int lastCount = m_size - last * BlockSize;
+        --m_size;
+        if (lastCount == 1) {
+            freeBlock(m_blocks[last]);
+            m_blocks.remove(last);
+        }
+    }
+
+    const T& operator[](int index) const {
+        assert(index >= 0 && index < m_size);
+        return m_blocks[index / BlockSize].at(index % BlockSize);
+    }
+
+    T& operator[](int index) {
+        assert(index >= 0 && index < m_size);
+        return m_blocks[index / BlockSize].at(index % BlockSize);
+    }
+
+    int size() const { return m_size; }
+
+    Iterator iterator() { return Iterator(this, 0, false); }
+    ConstIterator iterator() const { return ConstIterator(this, 0, false); }
+
+    Iterator reverseIterator() { return Iterator(this, m_size - 1, true); }
+    ConstIterator reverseIterator() const { return ConstIterator(this, m_size - 1, true); }
+
+    ElementIterator<false> begin() { return ElementIterator<false>(this, 0); }
+    ElementIterator<false> end() { return ElementIterator<false>(this, m_size); }
+    ElementIterator<true> begin() const { return ElementIterator<true>(this, 0); }
+    ElementIterator<true> end() const { return ElementIterator<true>(this, m_size); }
+
+private:
+    static constexpr int kMask = BlockSize - 1;
+
+    // BlockSize slots, element k of the block lives in slot (head + k) mod BlockSize
+    struct Block {
+        T* data;
+        int head;
+
+        T& at(int k) const { return data[(head + k) & kMask]; }
+    };
+
+    int m_size;
+    Array<Block> m_blocks;
+
+    void addBlock() {
+        m_blocks.insert(Block{ MallocAllocator<T>().allocate(BlockSize), 0 });
+    }
+
+    void freeBlock(Block& block) {
+        MallocAllocator<T>().deallocate(block.data, BlockSize);
+    }
+
+    void clearElements() {
+        for (int b = 0; b < m_blocks.size(); ++b) {
+            const int count = std::min(BlockSize, m_size - b * BlockSize);
+            for (int k = 0; k < count; ++k) m_blocks[b].at(k).~T();
+            freeBlock(m_blocks[b]);
+        }
+        m_blocks.erase_range(0, m_blocks.size());
+        m_size = 0;
+    }
+};
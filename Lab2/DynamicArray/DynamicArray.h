@@ -4,6 +4,12 @@
 #pragma once
 
 #include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <algorithm>
+#include <iterator>
+#include <utility>
 #include <new>
 #include <cassert>
 #include <type_traits>
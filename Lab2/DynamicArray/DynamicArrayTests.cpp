@@ -2,6 +2,11 @@
 #include <gtest/gtest.h>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <iterator>
 
 class Player {
 public:
@@ -193,6 +198,369 @@ TEST(ComplexTypes, PlayerHealthAndInventory) {
     }
 }
 
+TEST(ArrayContiguous, BeginEndAndData) {
+    Array<int> a;
+    for (int i = 0; i < 20; ++i) a.insert((i * 7) % 20);
+    ASSERT_EQ(a.end() - a.begin(), a.size());
+    EXPECT_EQ(a.data(), &a[0]);
+
+    std::sort(a.begin(), a.end());
+    int expected = 0;
+    for (int value : a) {
+        EXPECT_EQ(value, expected);
+        ++expected;
+    }
+
+    const Array<int>& c = a;
+    EXPECT_EQ(std::accumulate(c.begin(), c.end(), 0), 190);
+}
+
+// copies are counted, moves by byte copy are opted in below
+struct Tracked {
+    static int copies;
+    int value;
+    Tracked(int v) : value(v) {}
+    Tracked(const Tracked& other) : value(other.value) { ++copies; }
+    Tracked& operator=(const Tracked& other) { value = other.value; ++copies; return *this; }
+    ~Tracked() {}
+};
+int Tracked::copies = 0;
+
+template<>
+struct is_trivially_relocatable<Tracked> : std::true_type {};
+
+TEST(ArrayRelocatable, PodInsertRemoveInMiddle) {
+    struct Point { int x; double y; };
+    Array<Point> a;
+    std::vector<int> expected;
+    for (int i = 0; i < 1000; ++i) {
+        const int index = (i * 37) % (a.size() + 1);
+        a.insert(index, Point{ i, i * 0.5 });
+        expected.insert(expected.begin() + index, i);
+    }
+    for (int i = 0; i < 300; ++i) {
+        const int index = (i * 53) % a.size();
+        a.remove(index);
+        expected.erase(expected.begin() + index);
+    }
+    ASSERT_EQ(a.size(), static_cast<int>(expected.size()));
+    for (int i = 0; i < a.size(); ++i) {
+        EXPECT_EQ(a[i].x, expected[i]);
+        EXPECT_EQ(a[i].y, expected[i] * 0.5);
+    }
+}
+
+TEST(ArrayRelocatable, OptInSkipsCopiesOnShiftAndGrow) {
+    Tracked::copies = 0;
+    Array<Tracked> a;
+    for (int i = 0; i < 100; ++i) a.insert(0, Tracked(i));
+    // one copy per insert, none for the tail shifts or the regrowths
+    EXPECT_EQ(Tracked::copies, 100);
+    a.remove(50);
+    a.remove(0);
+    EXPECT_EQ(Tracked::copies, 100);
+    ASSERT_EQ(a.size(), 98);
+    EXPECT_EQ(a[0].value, 98);
+    EXPECT_EQ(a[49].value, 48);
+    EXPECT_EQ(a[97].value, 0);
+}
+
+// upstream resource that counts what reaches it
+class CountingResource : public std::pmr::memory_resource {
+public:
+    int allocations = 0;
+    int deallocations = 0;
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        ++allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        ++deallocations;
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+TEST(ArrayAllocator, ArenaServesManyArraysFromFewChunks) {
+    CountingResource upstream;
+    {
+        ArenaResource arena(4096, &upstream);
+        for (int n = 0; n < 1000; ++n) {
+            PmrArray<int> a(&arena);
+            for (int i = 0; i < 20; ++i) a.insert(i);
+            PmrArray<std::string> names(&arena);
+            names.insert("player" + std::to_string(n));
+            EXPECT_EQ(a[19], 19);
+            EXPECT_EQ(names[0], "player" + std::to_string(n));
+        }
+        // chunks double, so about log2 of the total bytes
+        EXPECT_LE(upstream.allocations, 16);
+        EXPECT_EQ(upstream.deallocations, 0);
+    }
+    EXPECT_EQ(upstream.deallocations, upstream.allocations);
+}
+
+TEST(ArrayAllocator, PoolReusesFreedBlocks) {
+    CountingResource upstream;
+    PoolResource pool(&upstream);
+    for (int round = 0; round < 100; ++round) {
+        PmrArray<double> a(&pool);
+        for (int i = 0; i < 200; ++i) a.insert(i * 0.5);
+        EXPECT_EQ(a[199], 99.5);
+    }
+    const int afterFirstRounds = upstream.allocations;
+    EXPECT_LE(afterFirstRounds, 10);
+    for (int round = 0; round < 100; ++round) {
+        PmrArray<double> a(&pool);
+        for (int i = 0; i < 200; ++i) a.insert(i * 0.5);
+    }
+    EXPECT_EQ(upstream.allocations, afterFirstRounds);
+
+    // blocks above the largest class pass through
+    void* big = pool.allocate(100000, alignof(double));
+    EXPECT_EQ(upstream.allocations, afterFirstRounds + 1);
+    pool.deallocate(big, 100000, alignof(double));
+    EXPECT_EQ(upstream.deallocations, 1);
+}
+
+TEST(ArrayAllocator, AssignmentKeepsEachArraysResource) {
+    ArenaResource first, second;
+    PmrArray<std::string> a(&first);
+    PmrArray<std::string> b(&second);
+    for (int i = 0; i < 30; ++i) b.insert("item" + std::to_string(i));
+
+    a = b;
+    EXPECT_EQ(a.get_allocator().resource(), &first);
+    ASSERT_EQ(a.size(), 30);
+    EXPECT_EQ(a[29], "item29");
+
+    PmrArray<std::string> c(&first);
+    c = std::move(b);
+    EXPECT_EQ(c.get_allocator().resource(), &first);
+    ASSERT_EQ(c.size(), 30);
+    EXPECT_EQ(c[0], "item0");
+
+    // same resource: the storage itself moves
+    const std::string* storage = a.data();
+    PmrArray<std::string> d(&first);
+    d = std::move(a);
+    EXPECT_EQ(d.data(), storage);
+    EXPECT_EQ(a.size(), 0);
+
+    PmrArray<std::string> copy(d);
+    EXPECT_EQ(copy.get_allocator().resource(), std::pmr::get_default_resource());
+    EXPECT_EQ(copy[5], "item5");
+}
+
+template<typename A>
+bool storedInline(const A& a) {
+    const char* data = reinterpret_cast<const char*>(a.data());
+    const char* object = reinterpret_cast<const char*>(&a);
+    return data >= object && data < object + sizeof(A);
+}
+
+TEST(SmallArray, StaysInlineUntilOverflow) {
+    CountingResource upstream;
+    SmallArray<int, 4, std::pmr::polymorphic_allocator<int>> a(&upstream);
+    for (int i = 0; i < 4; ++i) a.insert(0, i);
+    EXPECT_EQ(upstream.allocations, 0);
+    EXPECT_TRUE(storedInline(a));
+
+    a.insert(2, 10); // 3 2 10 1 0
+    EXPECT_EQ(upstream.allocations, 1);
+    EXPECT_FALSE(storedInline(a));
+    ASSERT_EQ(a.size(), 5);
+    const int expected[] = { 3, 2, 10, 1, 0 };
+    for (int i = 0; i < 5; ++i) EXPECT_EQ(a[i], expected[i]);
+
+    a.remove(0);
+    EXPECT_EQ(a[0], 2);
+}
+
+TEST(SmallArray, CopyAndMoveInlineAndSpilled) {
+    SmallArray<std::string, 3> small;
+    small.insert("a");
+    small.insert("b");
+    SmallArray<std::string, 3> big;
+    for (int i = 0; i < 10; ++i) big.insert(std::to_string(i));
+
+    SmallArray<std::string, 3> smallCopy(small);
+    EXPECT_TRUE(storedInline(smallCopy));
+    EXPECT_EQ(smallCopy[1], "b");
+
+    SmallArray<std::string, 3> smallMoved(std::move(small));
+    EXPECT_TRUE(storedInline(smallMoved));
+    EXPECT_EQ(smallMoved[0], "a");
+    EXPECT_EQ(small.size(), 0);
+    small.insert("again");
+    EXPECT_EQ(small[0], "again");
+
+    // spilled storage is handed over as is
+    const std::string* storage = big.data();
+    SmallArray<std::string, 3> bigMoved(std::move(big));
+    EXPECT_EQ(bigMoved.data(), storage);
+    EXPECT_TRUE(storedInline(big));
+    EXPECT_EQ(big.size(), 0);
+
+    bigMoved = smallMoved;
+    ASSERT_EQ(bigMoved.size(), 2);
+    EXPECT_TRUE(storedInline(bigMoved));
+    smallMoved = std::move(smallCopy);
+    EXPECT_EQ(smallMoved[1], "b");
+    for (const std::string& value : bigMoved) EXPECT_FALSE(value.empty());
+}
+
+struct ThrowingMove {
+    ThrowingMove() = default;
+    ThrowingMove(const ThrowingMove&) = default;
+    ThrowingMove(ThrowingMove&&) noexcept(false) {}
+    ThrowingMove& operator=(const ThrowingMove&) = default;
+};
+
+TEST(SmallArray, MoveIsNoexceptOnlyWhenElementsMoveNoexcept) {
+    static_assert(std::is_nothrow_move_constructible<SmallArray<std::string, 4>>::value, "");
+    static_assert(std::is_nothrow_move_assignable<SmallArray<std::string, 4>>::value, "");
+    static_assert(!std::is_nothrow_move_constructible<SmallArray<ThrowingMove, 4>>::value, "");
+    static_assert(!std::is_nothrow_move_assignable<SmallArray<ThrowingMove, 4>>::value, "");
+    // heap storage is handed over whole, whatever the element
+    static_assert(std::is_nothrow_move_assignable<Array<ThrowingMove>>::value, "");
+    SUCCEED();
+}
+
+TEST(ArrayBulk, EmplaceAndRvalueInsertMove) {
+    Array<Player> a;
+    Player knight(90, { "sword", "shield" });
+    const std::string* items = knight.inventory.data();
+    a.insert(std::move(knight));
+    EXPECT_EQ(a[0].inventory.data(), items); // moved, not copied
+
+    a.emplace(70, std::vector<std::string>{ "bow" });
+    EXPECT_EQ(a.emplace_at(1, 80), 1);
+    ASSERT_EQ(a.size(), 3);
+    EXPECT_EQ(a[0].health, 90);
+    EXPECT_EQ(a[1].health, 80);
+    EXPECT_EQ(a[2].inventory[0], "bow");
+
+    // an element of the array itself, while the array regrows
+    Array<std::string> s(1);
+    s.insert("first");
+    for (int i = 0; i < 10; ++i) s.insert(0, s[s.size() - 1]);
+    for (const std::string& value : s) EXPECT_EQ(value, "first");
+}
+
+TEST(ArrayBulk, RangeInsertGrowsOnce) {
+    CountingResource upstream;
+    PmrArray<int> a(&upstream);
+    std::vector<int> values(1000);
+    std::iota(values.begin(), values.end(), 0);
+    a.append(values.begin(), values.end());
+    EXPECT_EQ(upstream.allocations, 2);
+    ASSERT_EQ(a.size(), 1000);
+
+    int middle[] = { -1, -2, -3 };
+    EXPECT_EQ(a.insert_range(500, std::begin(middle), std::end(middle)), 500);
+    ASSERT_EQ(a.size(), 1003);
+    EXPECT_EQ(a[499], 499);
+    EXPECT_EQ(a[500], -1);
+    EXPECT_EQ(a[502], -3);
+    EXPECT_EQ(a[503], 500);
+
+    a.erase_range(500, 503);
+    EXPECT_TRUE(std::equal(a.begin(), a.end(), values.begin(), values.end()));
+
+    // a range out of the array itself
+    a.erase_range(4, a.size());
+    a.insert_range(2, a.begin(), a.end());
+    const int expected[] = { 0, 1, 0, 1, 2, 3, 2, 3 };
+    EXPECT_TRUE(std::equal(a.begin(), a.end(), std::begin(expected), std::end(expected)));
+
+    // single pass input
+    std::istringstream in("7 8 9");
+    a.insert_range(1, std::istream_iterator<int>(in), std::istream_iterator<int>());
+    EXPECT_EQ(a[0], 0);
+    EXPECT_EQ(a[1], 7);
+    EXPECT_EQ(a[3], 9);
+    EXPECT_EQ(a[4], 1);
+    EXPECT_EQ(a.size(), 11);
+}
+
+TEST(ArrayBulk, ReserveAndShrinkToFit) {
+    Array<std::string> a;
+    a.reserve(100);
+    EXPECT_EQ(a.capacity(), 100);
+    const std::string* storage = a.data();
+    for (int i = 0; i < 100; ++i) a.insert(std::to_string(i));
+    EXPECT_EQ(a.data(), storage);
+
+    a.erase_range(10, 100);
+    a.shrink_to_fit();
+    EXPECT_EQ(a.capacity(), 10);
+    EXPECT_EQ(a[9], "9");
+
+    SmallArray<std::string, 4> small;
+    for (int i = 0; i < 6; ++i) small.insert(std::to_string(i));
+    small.erase_range(0, 3);
+    small.shrink_to_fit();
+    EXPECT_TRUE(storedInline(small));
+    EXPECT_EQ(small.capacity(), 4);
+    EXPECT_EQ(small[0], "3");
+    EXPECT_EQ(small[2], "5");
+}
+
+TEST(TieredArray, RandomInsertRemoveMatchesVector) {
+    TieredArray<std::string, 8> t;
+    std::vector<std::string> expected;
+    std::mt19937 rng(25);
+    for (int step = 0; step < 3000; ++step) {
+        const bool grow = expected.size() < 20 || rng() % 3 != 0;
+        if (grow) {
+            const int index = static_cast<int>(rng() % (expected.size() + 1));
+            const std::string value = "v" + std::to_string(step);
+            EXPECT_EQ(t.insert(index, value), index);
+            expected.insert(expected.begin() + index, value);
+        }
+        else {
+            const int index = static_cast<int>(rng() % expected.size());
+            t.remove(index);
+            expected.erase(expected.begin() + index);
+        }
+        ASSERT_EQ(t.size(), static_cast<int>(expected.size()));
+    }
+    for (int i = 0; i < t.size(); ++i) EXPECT_EQ(t[i], expected[i]);
+
+    // down to nothing and back
+    while (t.size() > 0) t.remove(t.size() / 2);
+    t.insert("again");
+    EXPECT_EQ(t[0], "again");
+}
+
+TEST(TieredArray, IteratorsCopyAndMove) {
+    TieredArray<int, 4> t;
+    for (int i = 0; i < 30; ++i) t.insert(0, i); // 29 .. 0
+
+    int expected = 29;
+    for (auto it = t.iterator(); it.hasNext(); it.next()) EXPECT_EQ(it.get(), expected--);
+    expected = 0;
+    for (auto it = t.reverseIterator(); it.hasNext(); it.next()) EXPECT_EQ(it.get(), expected++);
+
+    std::sort(t.begin(), t.end());
+    expected = 0;
+    for (int value : t) EXPECT_EQ(value, expected++);
+    EXPECT_EQ(t.end() - t.begin(), 30);
+
+    TieredArray<int, 4> copy(t);
+    copy[3] = 100;
+    EXPECT_EQ(t[3], 3);
+    TieredArray<int, 4> moved(std::move(copy));
+    EXPECT_EQ(moved[3], 100);
+    EXPECT_EQ(copy.size(), 0);
+    t = moved;
+    EXPECT_EQ(t[3], 100);
+    const TieredArray<int, 4>& c = t;
+    EXPECT_EQ(std::accumulate(c.begin(), c.end(), 0), 435 + 97);
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
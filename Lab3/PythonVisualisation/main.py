@@ -1,29 +1,32 @@
 import sys
+import json
 import pandas as pd
 import matplotlib.pyplot as plt
-import numpy as np
 
-csv_file = sys.argv[1] if len(sys.argv) > 1 else "benchmark_results.csv"
-df = pd.read_csv(csv_file)
+# usage: main.py [benchmark_results.json] [type] [distribution]
+json_file = sys.argv[1] if len(sys.argv) > 1 else "benchmark_results.json"
+element_type = sys.argv[2] if len(sys.argv) > 2 else "int32"
+distribution = sys.argv[3] if len(sys.argv) > 3 else "random"
 
-# ensure numeric
-df = df.sort_values("size")
-sizes = df["size"].to_numpy()
+with open(json_file) as f:
+    df = pd.DataFrame(json.load(f)["benchmarks"])
 
-qs_avg = df["qs_avg_ns"].to_numpy().astype(np.float64)
-is_avg = df["is_avg_ns"].to_numpy().astype(np.float64)
+df = df[(df["type"] == element_type) & (df["distribution"] == distribution)]
+df = df.sort_values("size")
 
 plt.figure(figsize=(9,6))
 
-# Plot average times (log-log)
-plt.plot(sizes, qs_avg, marker='o', label='Quicksort (no insertion opt) [ns]')
-plt.plot(sizes, is_avg, marker='s', label='Insertion sort (reversed input) [ns]')
+# median time per element, the band spans median to p95
+for algorithm, rows in df.groupby("algorithm"):
+    sizes = rows["size"].to_numpy()
+    plt.plot(sizes, rows["ns_per_element"], marker='o', label=algorithm)
+    plt.fill_between(sizes, rows["ns_per_element"], rows["p95_ns"] / sizes, alpha=0.15)
 
-plt.xscale('log', base=2)
+plt.xscale('log', base=10)
 plt.yscale('log')
-plt.xlabel('Array size (n, log2 scale)')
-plt.ylabel('Average time (ms, log scale)')
-plt.title('Benchmark: Quicksort (no insertion opt) vs Insertion sort on reversed arrays')
+plt.xlabel('Array size (n, log10 scale)')
+plt.ylabel('Median time per element (ns, log scale)')
+plt.title(f'Benchmark: {element_type}, {distribution} input')
 plt.grid(True, which='both', ls='--', lw=0.5)
 plt.legend()
 
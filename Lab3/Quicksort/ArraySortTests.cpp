@@ -0,0 +1,56 @@
+#include "Quicksort.cpp"
+#include "../../Lab2/DynamicArray/DynamicArray.cpp"
+#include <gtest/gtest.h>
+#include <vector>
+#include <string>
+
+// qs::sort on the containers of Lab2: contiguous iterators, so the elements are
+// sorted where they are, through the T* overload, without a copy.
+
+static_assert(std::contiguous_iterator<std::ranges::iterator_t<Array<int>>>);
+static_assert(std::contiguous_iterator<std::ranges::iterator_t<SmallArray<std::string, 8>>>);
+
+TEST(ArraySort, SortsArrayInPlace) {
+    Array<int> a;
+    std::mt19937 rng(18);
+    std::vector<int> expected;
+    for (int i = 0; i < 5000; ++i) {
+        int value = std::uniform_int_distribution<int>(-1000, 1000)(rng);
+        a.insert(value);
+        expected.push_back(value);
+    }
+    std::sort(expected.begin(), expected.end());
+    const int* storage = a.data();
+
+    qs::sort(a);
+    EXPECT_EQ(a.data(), storage);
+    EXPECT_TRUE(std::equal(a.begin(), a.end(), expected.begin(), expected.end()));
+
+    qs::sort(a.begin(), a.end(), std::greater<int>());
+    EXPECT_EQ(a.data(), storage);
+    EXPECT_TRUE(std::equal(a.begin(), a.end(), expected.rbegin(), expected.rend()));
+}
+
+TEST(ArraySort, SortsSmallArrayInlineAndSpilled) {
+    std::mt19937 rng(19);
+    // 40 elements stay in the inline buffer, 300 have spilled to the heap
+    for (int n : { 40, 300 }) {
+        SmallArray<std::string, 64> a;
+        std::vector<std::string> expected;
+        for (int i = 0; i < n; ++i) {
+            std::string value = std::to_string(rng() % 1000);
+            a.insert(value);
+            expected.push_back(value);
+        }
+        std::sort(expected.begin(), expected.end());
+        const std::string* storage = a.data();
+
+        qs::sort(a);
+        EXPECT_EQ(a.data(), storage) << "n=" << n;
+        EXPECT_TRUE(std::equal(a.begin(), a.end(), expected.begin(), expected.end())) << "n=" << n;
+
+        qs::sort(a.begin(), a.end(), std::greater<>());
+        EXPECT_EQ(a.data(), storage) << "n=" << n;
+        EXPECT_TRUE(std::equal(a.begin(), a.end(), expected.rbegin(), expected.rend())) << "n=" << n;
+    }
+}
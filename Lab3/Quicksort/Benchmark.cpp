@@ -1,6 +1,3 @@
-#pragma once
-
-
 #include <chrono>
 #include <fstream>
 #include <iostream>
@@ -11,99 +8,478 @@
 #include <string>
 #include <limits>
 #include <random>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
 
 #include "Quicksort.cpp"
 
+// Sorting benchmark: every algorithm below on every element type, input
+// distribution and size, timed with warm-up and repeated samples.
+// Results go to stdout and to a JSON file, see usage() for the options.
+// Build in Release, Debug numbers are meaningless.
 
+namespace bench {
 
-int main(int argc, char** argv) {
-    std::vector<std::size_t> sizes = {
-        1, 5, 10, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 65, 70,
-        75, 80, 85, 90, 95, 100
+    /// 64-byte record sorted by its key, stands in for heavy row types.
+    struct record {
+        std::uint64_t key;
+        std::uint64_t payload[7];
+
+        bool operator<(const record& other) const { return key < other.key; }
+    };
+
+    /// 200-byte record, where moving elements costs more than comparing them.
+    struct wide_record {
+        std::uint64_t key;
+        std::uint64_t payload[24];
+
+        bool operator<(const wide_record& other) const { return key < other.key; }
+    };
+
+    struct options {
+        std::vector<std::size_t> sizes = {
+            1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+        };
+        std::size_t max_size = 100000000;
+        std::string filter;
+        int repetitions = 5;     // timed samples at least
+        int max_repetitions = 100;
+        double min_time = 0.1;   // seconds of samples at least, unless max_repetitions is hit
+        std::string json_path = "benchmark_results.json";
+        // calibration mode: measure cutoffs and write them here instead of benchmarking
+        std::string calibrate_path;
+        // cutoffs to load with qs::load_tuning before running, defaults otherwise
+        std::string tuning_path;
+    };
+
+    struct result {
+        std::string algorithm;
+        std::string type;
+        std::string distribution;
+        std::size_t size = 0;
+        int repetitions = 0;
+        std::size_t batch = 0;
+        double median_ns = 0;
+        double p95_ns = 0;
+        double mad_ns = 0;
+        double min_ns = 0;
+        // counters of one extra untimed run, QS_ENABLE_STATS builds only
+        bool has_stats = false;
+        qs::sort_stats stats{};
+    };
+
+    const char* const distributions[] = { "random", "sorted", "reversed", "organ_pipe", "few_unique", "sawtooth" };
+
+    /// Keys of one distribution, converted to the element type by make_value.
+    std::vector<std::uint64_t> make_keys(const std::string& distribution, std::size_t n, std::mt19937_64& rng) {
+        std::vector<std::uint64_t> keys(n);
+        const std::size_t tooth = std::max<std::size_t>(1, n / 16);
+        for (std::size_t i = 0; i < n; ++i) {
+            if (distribution == "random") keys[i] = rng();
+            else if (distribution == "sorted") keys[i] = i;
+            else if (distribution == "reversed") keys[i] = n - i;
+            else if (distribution == "organ_pipe") keys[i] = i < n / 2 ? i : n - i;
+            else if (distribution == "few_unique") keys[i] = rng() % 16;
+            else keys[i] = i % tooth; // sawtooth
+        }
+        return keys;
+    }
+
+    // conversions keep the order of the keys below 2^31, random keys just scatter
+    template<typename T>
+    T make_value(std::uint64_t key) {
+        return static_cast<T>(key);
+    }
+
+    template<>
+    std::string make_value<std::string>(std::uint64_t key) {
+        char digits[24];
+        std::snprintf(digits, sizeof(digits), "%020llu", static_cast<unsigned long long>(key));
+        return digits;
+    }
+
+    template<>
+    record make_value<record>(std::uint64_t key) {
+        record r{};
+        r.key = key;
+        r.payload[0] = ~key;
+        return r;
+    }
+
+    template<>
+    wide_record make_value<wide_record>(std::uint64_t key) {
+        wide_record r{};
+        r.key = key;
+        r.payload[0] = ~key;
+        return r;
+    }
+
+    template<typename T> const char* type_name();
+    template<> const char* type_name<std::int32_t>() { return "int32"; }
+    template<> const char* type_name<std::uint64_t>() { return "uint64"; }
+    template<> const char* type_name<double>() { return "double"; }
+    template<> const char* type_name<std::string>() { return "string"; }
+    template<> const char* type_name<record>() { return "record64"; }
+    template<> const char* type_name<wide_record>() { return "record200"; }
+
+    // big element types stop early, 10^8 strings do not fit in memory
+    template<typename T>
+    std::size_t type_max_size() {
+        if constexpr (std::is_same_v<T, std::string>) return 1000000;
+        else if constexpr (std::is_same_v<T, record>) return 10000000;
+        else if constexpr (std::is_same_v<T, wide_record>) return 1000000;
+        else return std::numeric_limits<std::size_t>::max();
+    }
+
+    template<typename T>
+    struct algorithm {
+        const char* name;
+        void (*run)(T* first, T* last, qs::scratch_buffer<T>& buffer);
+        // fills qs::last_sort_stats()
+        bool reports_stats = false;
     };
 
-    const int trials = 5; // runs per size, to average
+    template<typename T>
+    std::vector<algorithm<T>> algorithms() {
+        return {
+            { "qs::sort", [](T* first, T* last, qs::scratch_buffer<T>&) { qs::sort(first, last, std::less<T>(), true); }, true },
+            { "qs::adaptive_sort", [](T* first, T* last, qs::scratch_buffer<T>&) { qs::adaptive_sort(first, last, std::less<T>()); } },
+            { "qs::stable_sort", [](T* first, T* last, qs::scratch_buffer<T>& buffer) { qs::stable_sort(first, last, std::less<T>(), buffer); } },
+            { "qs::parallel_sort", [](T* first, T* last, qs::scratch_buffer<T>&) { qs::parallel_sort(first, last, std::less<T>()); } },
+            { "std::sort", [](T* first, T* last, qs::scratch_buffer<T>&) { std::sort(first, last); } },
+            { "std::stable_sort", [](T* first, T* last, qs::scratch_buffer<T>&) { std::stable_sort(first, last); } },
+        };
+    }
+
+    double percentile(const std::vector<double>& sorted, double p) {
+        // nearest rank
+        const std::size_t rank = static_cast<std::size_t>(std::ceil(p * sorted.size()));
+        return sorted[std::min(sorted.size() - 1, rank == 0 ? 0 : rank - 1)];
+    }
+
+    double median(std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        const std::size_t mid = values.size() / 2;
+        return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+    }
+
+    /// Time one algorithm on one input. Small inputs are sorted in batches of
+    /// copies so that every sample spans well above the clock resolution; the
+    /// copies are refreshed outside the timed region.
+    template<typename T>
+    bool measure(const algorithm<T>& algo, const std::vector<T>& input, const options& opts, result& out) {
+        const std::size_t n = input.size();
+        const std::size_t batch = std::max<std::size_t>(1, 100000 / std::max<std::size_t>(n, 1));
+        std::vector<T> work(batch * n);
+        qs::scratch_buffer<T> buffer;
+
+        auto refill = [&]() {
+            for (std::size_t b = 0; b < batch; ++b) std::copy(input.begin(), input.end(), work.begin() + b * n);
+        };
+        auto sample = [&]() {
+            refill();
+            const auto t0 = std::chrono::steady_clock::now();
+            for (std::size_t b = 0; b < batch; ++b) algo.run(work.data() + b * n, work.data() + (b + 1) * n, buffer);
+            const auto t1 = std::chrono::steady_clock::now();
+            return std::chrono::duration<double, std::nano>(t1 - t0).count() / batch;
+        };
+
+        // warm-up: caches, page faults, scratch buffer growth; also checks the result
+        sample();
+        for (std::size_t b = 0; b < batch; ++b) {
+            if (!is_sorted_array(work.data() + b * n, work.data() + (b + 1) * n, std::less<T>())) return false;
+        }
+
+        std::vector<double> samples;
+        double total_ns = 0;
+        while (static_cast<int>(samples.size()) < opts.max_repetitions &&
+            (static_cast<int>(samples.size()) < opts.repetitions || total_ns * batch < opts.min_time * 1e9)) {
+            samples.push_back(sample());
+            total_ns += samples.back();
+        }
+
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        const double med = median(samples);
+        std::vector<double> deviations;
+        for (double s : samples) deviations.push_back(std::abs(s - med));
 
-    std::ofstream csv("benchmark_results.csv");
-    if (!csv) {
-        std::cerr << "Failed to open benchmark_results.csv for writing\n";
-        return 1;
+        out.size = n;
+        out.repetitions = static_cast<int>(samples.size());
+        out.batch = batch;
+        out.median_ns = med;
+        out.p95_ns = percentile(sorted, 0.95);
+        out.mad_ns = median(deviations);
+        out.min_ns = sorted.front();
+
+        if (qs::stats_enabled && algo.reports_stats && n > 0) {
+            refill();
+            algo.run(work.data(), work.data() + n, buffer);
+            out.has_stats = true;
+            out.stats = qs::last_sort_stats();
+        }
+        return true;
+    }
+
+    template<typename T>
+    void run_type(const options& opts, std::vector<result>& results, bool& ok) {
+        const std::vector<algorithm<T>> algos = algorithms<T>();
+        for (std::size_t n : opts.sizes) {
+            if (n > opts.max_size || n > type_max_size<T>()) continue;
+            for (const char* distribution : distributions) {
+                std::vector<T> input;
+                for (const algorithm<T>& algo : algos) {
+                    const std::string name = std::string(algo.name) + "/" + type_name<T>() + "/" + distribution + "/" + std::to_string(n);
+                    if (!opts.filter.empty() && name.find(opts.filter) == std::string::npos) continue;
+
+                    if (input.empty() && n > 0) {
+                        // same seed for every algorithm, so they all sort the same input
+                        std::mt19937_64 rng(n);
+                        std::vector<std::uint64_t> keys = make_keys(distribution, n, rng);
+                        input.reserve(n);
+                        for (std::uint64_t key : keys) input.push_back(make_value<T>(key));
+                    }
+
+                    result r{ .algorithm = algo.name, .type = type_name<T>(), .distribution = distribution };
+                    if (!measure(algo, input, opts, r)) {
+                        std::cerr << name << ": result is NOT sorted\n";
+                        ok = false;
+                        continue;
+                    }
+                    results.push_back(r);
+                    std::cout << std::left << std::setw(48) << name << std::right << std::fixed
+                        << std::setprecision(1) << std::setw(16) << r.median_ns << " ns"
+                        << "  p95 " << std::setw(14) << r.p95_ns
+                        << "  mad " << std::setw(12) << r.mad_ns
+                        << std::setprecision(3) << "  " << std::setw(9) << r.median_ns / std::max<std::size_t>(n, 1) << " ns/elem\n";
+                    if (r.has_stats) {
+                        std::cout << std::setprecision(3)
+                            << "    comparisons " << r.stats.comparisons << "  swaps " << r.stats.swaps
+                            << "  depth " << r.stats.max_depth << "  partitions " << r.stats.partitions
+                            << " (" << r.stats.bad_partitions << " bad, imbalance " << r.stats.mean_imbalance() << ")"
+                            << "  cycles " << r.stats.cycles << "  instructions " << r.stats.instructions
+                            << "  branch-misses " << r.stats.branch_misses << "  llc-misses " << r.stats.llc_misses << "\n";
+                    }
+                }
+            }
+        }
+    }
+
+    template<typename T>
+    std::vector<T> random_input(std::size_t n) {
+        std::mt19937_64 rng(n);
+        std::vector<T> input;
+        input.reserve(n);
+        for (std::uint64_t key : make_keys("random", n, rng)) input.push_back(make_value<T>(key));
+        return input;
+    }
+
+    /// Median time of one sort of input in ns.
+    template<typename T>
+    double time_sort(const std::vector<T>& input, std::type_identity_t<void (*)(T*, T*, qs::scratch_buffer<T>&)> run) {
+        options quick;
+        quick.repetitions = 7;
+        quick.min_time = 0.05;
+        result r;
+        if (!measure(algorithm<T>{ "calibration", run }, input, quick, r)) throw std::runtime_error("calibration sort failed");
+        return r.median_ns;
+    }
+
+    /// Measure the cutoffs of qs::sort for T on this machine, on random input:
+    /// the small-sort threshold with the lowest time for 10^4 elements, the
+    /// smallest size from which radix sort wins at every larger measured size,
+    /// and the parallel cutoff with the lowest time for 2^21 elements.
+    template<typename T>
+    qs::sort_tuning calibrate() {
+        auto comparison_sort = [](T* first, T* last, qs::scratch_buffer<T>&) { qs::sort(first, last, std::less<T>(), true); };
+        qs::sort_tuning best = qs::tuning_for<T>();
+        qs::sort_tuning trial = best;
+        // comparison sorts only until the radix crossover is measured
+        trial.radix_threshold = std::numeric_limits<std::ptrdiff_t>::max();
+
+        const std::vector<T> small_input = random_input<T>(10000);
+        double best_time = std::numeric_limits<double>::max();
+        for (std::ptrdiff_t threshold : { 4, 6, 8, 10, 12, 16, 20, 24, 32, 48 }) {
+            trial.insertion_threshold = threshold;
+            qs::set_tuning<T>(trial);
+            const double time = time_sort(small_input, comparison_sort);
+            if (time < best_time) {
+                best_time = time;
+                best.insertion_threshold = threshold;
+            }
+        }
+        trial.insertion_threshold = best.insertion_threshold;
+        qs::set_tuning<T>(trial);
+
+        if constexpr (qs::is_radix_sortable<T>::value) {
+            auto radix = [](T* first, T* last, qs::scratch_buffer<T>&) { qs::radix_sort(first, last); };
+            best.radix_threshold = std::numeric_limits<std::ptrdiff_t>::max();
+            // walk down from the largest size while radix sort keeps winning
+            for (std::ptrdiff_t n = std::ptrdiff_t(1) << 22; n >= std::ptrdiff_t(1) << 8; n /= 2) {
+                const std::vector<T> input = random_input<T>(n);
+                if (time_sort(input, radix) >= time_sort(input, comparison_sort)) break;
+                best.radix_threshold = n;
+            }
+        }
+
+        if (std::thread::hardware_concurrency() > 1) {
+            auto parallel = [](T* first, T* last, qs::scratch_buffer<T>&) { qs::parallel_sort(first, last, std::less<T>()); };
+            const std::vector<T> input = random_input<T>(std::size_t(1) << 21);
+            trial.radix_threshold = best.radix_threshold;
+            best_time = std::numeric_limits<double>::max();
+            for (std::ptrdiff_t cutoff = std::ptrdiff_t(1) << 11; cutoff <= std::ptrdiff_t(1) << 18; cutoff *= 2) {
+                trial.parallel_cutoff = cutoff;
+                qs::set_tuning<T>(trial);
+                const double time = time_sort(input, parallel);
+                if (time < best_time) {
+                    best_time = time;
+                    best.parallel_cutoff = cutoff;
+                }
+            }
+        }
+
+        qs::set_tuning<T>(best);
+        std::cout << std::left << std::setw(12) << qs::tuning_key<T>() << std::right
+            << " insertion_threshold " << std::setw(4) << best.insertion_threshold
+            << "  parallel_cutoff " << std::setw(8) << best.parallel_cutoff
+            << "  radix_threshold " << best.radix_threshold << "\n";
+        return best;
     }
 
-    // Header:
-    csv << "size,qs_avg_ns,qs_min_ns,qs_max_ns,is_avg_ns,is_min_ns,is_max_ns\n";
+    void write_json(const std::string& path, const std::vector<result>& results) {
+        std::ofstream json(path);
+        if (!json) throw std::runtime_error("failed to open " + path + " for writing");
 
-    // comparator
-    auto comp = [](int a, int b) { return a < b; };
+#if defined(__clang__)
+        const std::string compiler = "clang " __clang_version__;
+#elif defined(__GNUC__)
+        const std::string compiler = "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+        const std::string compiler = "msvc " + std::to_string(_MSC_VER);
+#else
+        const std::string compiler = "unknown";
+#endif
+        const char* const simd[] = { "none", "avx2", "avx512" };
+#if QS_X86_SIMD
+        const char* level = simd[static_cast<int>(qs::detail::cpu_simd_level())];
+#else
+        const char* level = simd[0];
+#endif
 
-    for (std::size_t n : sizes) {
-        std::vector<long long> qs_times;
-        std::vector<long long> is_times;
-        qs_times.reserve(trials);
-        is_times.reserve(trials);
+        json << std::setprecision(10);
+        json << "{\n  \"context\": {\n"
+            << "    \"compiler\": \"" << compiler << "\",\n"
+#ifdef NDEBUG
+            << "    \"assertions\": false,\n"
+#else
+            << "    \"assertions\": true,\n"
+#endif
+            << "    \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n"
+            << "    \"simd\": \"" << level << "\"\n  },\n  \"benchmarks\": [";
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            const result& r = results[i];
+            json << (i ? ",\n" : "\n")
+                << "    {\"algorithm\": \"" << r.algorithm << "\", \"type\": \"" << r.type
+                << "\", \"distribution\": \"" << r.distribution << "\", \"size\": " << r.size
+                << ", \"repetitions\": " << r.repetitions << ", \"batch\": " << r.batch
+                << ", \"median_ns\": " << r.median_ns << ", \"p95_ns\": " << r.p95_ns
+                << ", \"mad_ns\": " << r.mad_ns << ", \"min_ns\": " << r.min_ns
+                << ", \"ns_per_element\": " << r.median_ns / std::max<std::size_t>(r.size, 1);
+            if (r.has_stats) {
+                json << ", \"stats\": {\"comparisons\": " << r.stats.comparisons << ", \"swaps\": " << r.stats.swaps
+                    << ", \"max_depth\": " << r.stats.max_depth << ", \"partitions\": " << r.stats.partitions
+                    << ", \"bad_partitions\": " << r.stats.bad_partitions << ", \"mean_imbalance\": " << r.stats.mean_imbalance()
+                    << ", \"cycles\": " << r.stats.cycles << ", \"instructions\": " << r.stats.instructions
+                    << ", \"branch_misses\": " << r.stats.branch_misses << ", \"llc_misses\": " << r.stats.llc_misses << "}";
+            }
+            json << "}";
+        }
+        json << "\n  ]\n}\n";
+    }
 
-        for (int t = 0; t < trials; ++t) {
-            // create reversed array: [n, n-1, ..., 1]
-            std::vector<int> base(n);
-            for (std::size_t i = 0; i < n; ++i) base[i] = static_cast<int>(n - i);
+    void usage() {
+        std::cerr << "usage: QuicksortBenchmark [options]\n"
+            << "  --sizes N,N,...     sizes to run (default 1, 10, ..., 10^8)\n"
+            << "  --max-size N        skip sizes above N\n"
+            << "  --filter TEXT       only cases whose algorithm/type/distribution/size contains TEXT\n"
+            << "  --repetitions N     timed samples at least (default 5)\n"
+            << "  --min-time SECONDS  keep sampling until this much time was measured (default 0.1)\n"
+            << "  --json PATH         output file (default benchmark_results.json)\n"
+            << "  --calibrate PATH    measure qs::sort cutoffs for every element type and write them\n"
+            << "                      to PATH\n"
+            << "  --tuning PATH       run with the cutoffs in PATH, as written by --calibrate\n";
+    }
 
-            // quicksort
-            std::vector<int> qarr = base;
-            auto t0 = std::chrono::steady_clock::now();
-            qs::sort(qarr.data(), qarr.data() + qarr.size(), comp, /*use_insertion_sort=*/false);
-            auto t1 = std::chrono::steady_clock::now();
-            auto qs_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
-            if (!is_sorted_array(qarr.data(), qarr.data() + qarr.size(), comp)) {
-                std::cerr << "Quicksort result is NOT sorted for n=" << n << " (trial " << t << ")\n";
+    bool parse(int argc, char** argv, options& opts) {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (i + 1 >= argc) return false;
+            const std::string value = argv[++i];
+            try {
+                if (arg == "--sizes") {
+                    opts.sizes.clear();
+                    std::stringstream list(value);
+                    for (std::string item; std::getline(list, item, ',');) opts.sizes.push_back(std::stoull(item));
+                }
+                else if (arg == "--max-size") opts.max_size = std::stoull(value);
+                else if (arg == "--filter") opts.filter = value;
+                else if (arg == "--repetitions") opts.repetitions = std::stoi(value);
+                else if (arg == "--min-time") opts.min_time = std::stod(value);
+                else if (arg == "--json") opts.json_path = value;
+                else if (arg == "--calibrate") opts.calibrate_path = value;
+                else if (arg == "--tuning") opts.tuning_path = value;
+                else return false;
             }
-            qs_times.push_back(qs_ns);
-
-            // insertion sort
-            std::vector<int> iarr = base;
-            auto ti0 = std::chrono::steady_clock::now();
-            qs::insertion_sort(iarr.data(), iarr.data() + iarr.size(), comp);
-            auto ti1 = std::chrono::steady_clock::now();
-            auto is_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(ti1 - ti0).count();
-            if (!is_sorted_array(iarr.data(), iarr.data() + iarr.size(), comp)) {
-                std::cerr << "Insertion sort result is NOT sorted for n=" << n << " (trial " << t << ")\n";
+            catch (const std::exception&) {
+                return false;
             }
-            is_times.push_back(is_ns);
         }
+        return opts.repetitions > 0;
+    }
+
+}
+
+int main(int argc, char** argv) {
+    bench::options opts;
+    if (!bench::parse(argc, argv, opts)) {
+        bench::usage();
+        return 2;
+    }
+    if (!opts.tuning_path.empty()) {
+        try {
+            qs::load_tuning(opts.tuning_path);
+        }
+        catch (const std::runtime_error& error) {
+            std::cerr << error.what() << "\n";
+            return 2;
+        }
+    }
+
+    if (!opts.calibrate_path.empty()) {
+        // one hardware thread cannot measure a parallel cutoff, those keep the default
+        std::map<std::string, qs::sort_tuning> tunings;
+        tunings[qs::tuning_key<std::int32_t>()] = bench::calibrate<std::int32_t>();
+        tunings[qs::tuning_key<std::uint64_t>()] = bench::calibrate<std::uint64_t>();
+        tunings[qs::tuning_key<double>()] = bench::calibrate<double>();
+        tunings[qs::tuning_key<std::string>()] = bench::calibrate<std::string>();
+        tunings[qs::tuning_key<bench::record>()] = bench::calibrate<bench::record>();
+        tunings[qs::tuning_key<bench::wide_record>()] = bench::calibrate<bench::wide_record>();
+        qs::save_tuning(opts.calibrate_path, tunings);
+        std::cout << "Wrote " << opts.calibrate_path << "\n";
+        return 0;
+    }
+
+    std::vector<bench::result> results;
+    bool ok = true;
+    bench::run_type<std::int32_t>(opts, results, ok);
+    bench::run_type<std::uint64_t>(opts, results, ok);
+    bench::run_type<double>(opts, results, ok);
+    bench::run_type<std::string>(opts, results, ok);
+    bench::run_type<bench::record>(opts, results, ok);
+    bench::run_type<bench::wide_record>(opts, results, ok);
 
-        auto avg = [](const std::vector<long long>& v) -> long double {
-            if (v.empty()) return 0.0L;
-            long double s = 0;
-            for (auto x : v) s += static_cast<long double>(x);
-            return s / v.size();
-            };
-        auto vmin = [](const std::vector<long long>& v) -> long long {
-            if (v.empty()) return 0;
-            return *std::min_element(v.begin(), v.end());
-            };
-        auto vmax = [](const std::vector<long long>& v) -> long long {
-            if (v.empty()) return 0;
-            return *std::max_element(v.begin(), v.end());
-            };
-
-        long double qs_avg = avg(qs_times);
-        long long qs_min = vmin(qs_times);
-        long long qs_max = vmax(qs_times);
-
-        long double is_avg = avg(is_times);
-        long long is_min = vmin(is_times);
-        long long is_max = vmax(is_times);
-
-        // write CSV row
-        csv << n << ","
-            << std::fixed << std::setprecision(0) << qs_avg << "," << qs_min << "," << qs_max << ","
-            << std::fixed << std::setprecision(0) << is_avg << "," << is_min << "," << is_max << "\n";
-
-        std::cout << "n=" << std::setw(7) << n
-            << "  qs_avg(ms)=" << std::setw(9) << (qs_avg / 1e6)
-            << "  is_avg(ms)=" << std::setw(9) << (is_avg / 1e6) << "\n";
-    }
-
-    csv.close();
-    std::cout << "Wrote benchmark_results.csv\n";
-    return 0;
+    bench::write_json(opts.json_path, results);
+    std::cout << "Wrote " << opts.json_path << "\n";
+    return ok ? 0 : 1;
 }
@@ -2,8 +2,198 @@
 
 namespace qs {
 
+    /// Compile-time switch for the sort instrumentation, see sort_stats.
+    constexpr bool stats_enabled = QS_ENABLE_STATS != 0;
+
+    /// What one qs::sort call did, collected only in builds with QS_ENABLE_STATS=1
+    /// and free otherwise. Comparisons made inside the SIMD partition kernels are
+    /// counted as one per element, radix passes make none. Swaps are those of the
+    /// scalar partitions. The hardware counters come from Linux perf_event_open,
+    /// measured in user space around the whole call; they stay -1 where the
+    /// kernel does not grant them.
+    struct sort_stats {
+        std::uint64_t comparisons = 0;
+        std::uint64_t swaps = 0;
+        std::uint64_t partitions = 0;
+        std::uint64_t bad_partitions = 0;
+        // sum over all partitions of |left - right| / (left + right)
+        double imbalance_sum = 0;
+        int max_depth = 0;
+
+        std::int64_t cycles = -1;
+        std::int64_t instructions = -1;
+        std::int64_t branch_misses = -1;
+        std::int64_t llc_misses = -1;
+
+        /// 0 when every pivot was the median, close to 1 for degenerate splits.
+        double mean_imbalance() const { return partitions ? imbalance_sum / partitions : 0; }
+    };
+
+    namespace detail {
+
+#if QS_ENABLE_STATS && defined(__linux__)
+        /// Hardware counters of the calling thread, opened once per thread.
+        /// Events the kernel refuses (perf_event_paranoid, containers, VMs
+        /// without a PMU) are skipped.
+        class perf_counters {
+        public:
+            perf_counters() {
+                const std::uint64_t events[] = {
+                    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                    PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+                };
+                for (int i = 0; i < 4; ++i) {
+                    perf_event_attr attr{};
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.size = sizeof(attr);
+                    attr.config = events[i];
+                    attr.disabled = 1;
+                    attr.exclude_kernel = 1;
+                    attr.exclude_hv = 1;
+                    m_fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+                }
+            }
+
+            perf_counters(const perf_counters&) = delete;
+            perf_counters& operator=(const perf_counters&) = delete;
+
+            ~perf_counters() {
+                for (int fd : m_fds) if (fd >= 0) close(fd);
+            }
+
+            void start() {
+                for (int fd : m_fds) {
+                    if (fd < 0) continue;
+                    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+                }
+            }
+
+            void stop(sort_stats& stats) {
+                std::int64_t* const out[] = { &stats.cycles, &stats.instructions, &stats.branch_misses, &stats.llc_misses };
+                for (int i = 0; i < 4; ++i) {
+                    std::uint64_t value;
+                    if (m_fds[i] < 0) continue;
+                    ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                    if (read(m_fds[i], &value, sizeof(value)) == sizeof(value)) *out[i] = static_cast<std::int64_t>(value);
+                }
+            }
+
+        private:
+            int m_fds[4];
+        };
+#else
+        class perf_counters {
+        public:
+            void start() {}
+            void stop(sort_stats&) {}
+        };
+#endif
+
+        struct stats_state {
+            sort_stats stats;
+            int depth = 0;
+            int scopes = 0;
+            perf_counters counters;
+        };
+
+        inline stats_state& thread_stats() {
+            thread_local stats_state state;
+            return state;
+        }
+
+        /// Marks a qs::sort call. The outermost scope on a thread resets the
+        /// counters and runs the hardware counters, nested calls add to them.
+        struct stats_scope {
+            constexpr stats_scope() {
+                if constexpr (stats_enabled) {
+                    if (std::is_constant_evaluated()) return;
+                    stats_state& state = thread_stats();
+                    if (state.scopes++ == 0) {
+                        state.stats = {};
+                        state.counters.start();
+                    }
+                }
+            }
+            constexpr ~stats_scope() {
+                if constexpr (stats_enabled) {
+                    if (std::is_constant_evaluated()) return;
+                    stats_state& state = thread_stats();
+                    if (--state.scopes == 0) state.counters.stop(state.stats);
+                }
+            }
+            stats_scope(const stats_scope&) = delete;
+            stats_scope& operator=(const stats_scope&) = delete;
+        };
+
+        /// One level of sort recursion, tracks the maximum depth.
+        struct recursion_level {
+            constexpr recursion_level() {
+                if constexpr (stats_enabled) {
+                    if (std::is_constant_evaluated()) return;
+                    stats_state& state = thread_stats();
+                    state.stats.max_depth = std::max(state.stats.max_depth, ++state.depth);
+                }
+            }
+            constexpr ~recursion_level() {
+                if constexpr (stats_enabled) {
+                    if (!std::is_constant_evaluated()) --thread_stats().depth;
+                }
+            }
+            recursion_level(const recursion_level&) = delete;
+            recursion_level& operator=(const recursion_level&) = delete;
+        };
+
+        // the counters are thread_local, so constant evaluation skips them
+        constexpr void count_comparisons(std::uint64_t count) {
+            if constexpr (stats_enabled) {
+                if (!std::is_constant_evaluated()) thread_stats().stats.comparisons += count;
+            }
+        }
+
+        constexpr void count_swaps(std::uint64_t count) {
+            if constexpr (stats_enabled) {
+                if (!std::is_constant_evaluated()) thread_stats().stats.swaps += count;
+            }
+        }
+
+        constexpr void count_partition(std::ptrdiff_t left_size, std::ptrdiff_t right_size, bool bad) {
+            if constexpr (stats_enabled) {
+                if (std::is_constant_evaluated()) return;
+                sort_stats& stats = thread_stats().stats;
+                ++stats.partitions;
+                stats.bad_partitions += bad;
+                if (left_size + right_size > 0) {
+                    stats.imbalance_sum += double(std::abs(left_size - right_size)) / double(left_size + right_size);
+                }
+            }
+        }
+
+        /// Comparator wrapper that counts its calls, qs::sort puts it around the
+        /// user's comparator when stats are enabled.
+        template<typename Compare>
+        struct counting_compare {
+            Compare comp;
+
+            template<typename A, typename B>
+            bool operator()(const A& a, const B& b) {
+                ++thread_stats().stats.comparisons;
+                return comp(a, b);
+            }
+        };
+
+    }
+
+    /// Counters of the last qs::sort call on this thread. All zero (hardware
+    /// counters -1) unless built with QS_ENABLE_STATS=1. Sorts running on other
+    /// threads, such as the workers of parallel_sort, are not included.
+    inline const sort_stats& last_sort_stats() {
+        return detail::thread_stats().stats;
+    }
+
     template<typename T, typename Compare>
-    void insertion_sort(T* first, T* last, Compare comp) {
+    constexpr void insertion_sort(T* first, T* last, Compare comp) {
+        if (first == last) return;
         for (T* it = first + 1; it != last; ++it) {
             T tmp = std::move(*it);
             T* j = it;
@@ -16,9 +206,279 @@ namespace qs {
         }
     }
 
+    /// Largest range sorted by a sorting network.
+    constexpr std::ptrdiff_t max_network_size = 16;
+
+    /// Small sorts use sorting networks for element types that are cheap to
+    /// copy, which lets the compiler turn every comparator into min/max or cmov.
+    template<typename T>
+    struct use_sorting_network : std::bool_constant<
+        std::is_trivially_copyable_v<T> && sizeof(T) <= 2 * sizeof(void*)> {
+    };
+
+    namespace detail {
+
+        struct comparator_pair {
+            std::uint8_t lo;
+            std::uint8_t hi;
+        };
+
+        /// Size-optimal sorting networks (best known comparator counts), one layer
+        /// of independent comparators per line. Every network was checked against
+        /// all 2^N inputs of zeros and ones. 14 and 15 are 16 with the top wires cut.
+        template<std::size_t N>
+        struct sorting_network {
+            static_assert(N <= 1, "no sorting network for this size");
+            static constexpr std::array<comparator_pair, 0> pairs{};
+        };
+
+        template<>
+        struct sorting_network<2> {
+            static constexpr std::array<comparator_pair, 1> pairs = { {
+                {0, 1}
+            } };
+        };
+
+        template<>
+        struct sorting_network<3> {
+            static constexpr std::array<comparator_pair, 3> pairs = { {
+                {0, 2},
+                {0, 1},
+                {1, 2}
+            } };
+        };
+
+        template<>
+        struct sorting_network<4> {
+            static constexpr std::array<comparator_pair, 5> pairs = { {
+                {0, 2}, {1, 3},
+                {0, 1}, {2, 3},
+                {1, 2}
+            } };
+        };
+
+        template<>
+        struct sorting_network<5> {
+            static constexpr std::array<comparator_pair, 9> pairs = { {
+                {0, 3}, {1, 4},
+                {0, 2}, {1, 3},
+                {0, 1}, {2, 4},
+                {1, 2}, {3, 4},
+                {2, 3}
+            } };
+        };
+
+        template<>
+        struct sorting_network<6> {
+            static constexpr std::array<comparator_pair, 12> pairs = { {
+                {0, 5}, {1, 3}, {2, 4},
+                {1, 2}, {3, 4},
+                {0, 3}, {2, 5},
+                {0, 1}, {2, 3}, {4, 5},
+                {1, 2}, {3, 4}
+            } };
+        };
+
+        template<>
+        struct sorting_network<7> {
+            static constexpr std::array<comparator_pair, 16> pairs = { {
+                {0, 6}, {2, 3}, {4, 5},
+                {0, 2}, {1, 4}, {3, 6},
+                {0, 1}, {2, 5}, {3, 4},
+                {1, 2}, {4, 6},
+                {2, 3}, {4, 5},
+                {1, 2}, {3, 4}, {5, 6}
+            } };
+        };
+
+        template<>
+        struct sorting_network<8> {
+            static constexpr std::array<comparator_pair, 19> pairs = { {
+                {0, 2}, {1, 3}, {4, 6}, {5, 7},
+                {0, 4}, {1, 5}, {2, 6}, {3, 7},
+                {0, 1}, {2, 3}, {4, 5}, {6, 7},
+                {2, 4}, {3, 5},
+                {1, 4}, {3, 6},
+                {1, 2}, {3, 4}, {5, 6}
+            } };
+        };
+
+        template<>
+        struct sorting_network<9> {
+            static constexpr std::array<comparator_pair, 25> pairs = { {
+                {0, 3}, {1, 7}, {2, 5}, {4, 8},
+                {0, 7}, {2, 4}, {3, 8}, {5, 6},
+                {0, 2}, {1, 3}, {4, 5}, {7, 8},
+                {1, 4}, {3, 6}, {5, 7},
+                {0, 1}, {2, 4}, {3, 5}, {6, 8},
+                {2, 3}, {4, 5}, {6, 7},
+                {1, 2}, {3, 4}, {5, 6}
+            } };
+        };
+
+        template<>
+        struct sorting_network<10> {
+            static constexpr std::array<comparator_pair, 29> pairs = { {
+                {0, 8}, {1, 9}, {2, 7}, {3, 5}, {4, 6},
+                {0, 2}, {1, 4}, {5, 8}, {7, 9},
+                {0, 3}, {2, 4}, {5, 7}, {6, 9},
+                {0, 1}, {3, 6}, {8, 9},
+                {1, 5}, {2, 3}, {4, 8}, {6, 7},
+                {1, 2}, {3, 5}, {4, 6}, {7, 8},
+                {2, 3}, {4, 5}, {6, 7},
+                {3, 4}, {5, 6}
+            } };
+        };
+
+        template<>
+        struct sorting_network<11> {
+            static constexpr std::array<comparator_pair, 35> pairs = { {
+                {0, 9}, {1, 6}, {2, 4}, {3, 7}, {5, 8},
+                {0, 1}, {3, 5}, {4, 10}, {6, 9}, {7, 8},
+                {1, 3}, {2, 5}, {4, 7}, {8, 10},
+                {0, 4}, {1, 2}, {3, 7}, {5, 9}, {6, 8},
+                {0, 1}, {2, 6}, {4, 5}, {7, 8}, {9, 10},
+                {2, 4}, {3, 6}, {5, 7}, {8, 9},
+                {1, 2}, {3, 4}, {5, 6}, {7, 8},
+                {2, 3}, {4, 5}, {6, 7}
+            } };
+        };
+
+        template<>
+        struct sorting_network<12> {
+            static constexpr std::array<comparator_pair, 39> pairs = { {
+                {0, 8}, {1, 7}, {2, 6}, {3, 11}, {4, 10}, {5, 9},
+                {0, 1}, {2, 5}, {3, 4}, {6, 9}, {7, 8}, {10, 11},
+                {0, 2}, {1, 6}, {5, 10}, {9, 11},
+                {0, 3}, {1, 2}, {4, 6}, {5, 7}, {8, 11}, {9, 10},
+                {1, 4}, {3, 5}, {6, 8}, {7, 10},
+                {1, 3}, {2, 5}, {6, 9}, {8, 10},
+                {2, 3}, {4, 5}, {6, 7}, {8, 9},
+                {4, 6}, {5, 7},
+                {3, 4}, {5, 6}, {7, 8}
+            } };
+        };
+
+        template<>
+        struct sorting_network<13> {
+            static constexpr std::array<comparator_pair, 45> pairs = { {
+                {0, 12}, {1, 10}, {2, 9}, {3, 7}, {5, 11}, {6, 8},
+                {1, 6}, {2, 3}, {4, 11}, {7, 9}, {8, 10},
+                {0, 4}, {1, 2}, {3, 6}, {7, 8}, {9, 10}, {11, 12},
+                {4, 6}, {5, 9}, {8, 11}, {10, 12},
+                {0, 5}, {3, 8}, {4, 7}, {6, 11}, {9, 10},
+                {0, 1}, {2, 5}, {6, 9}, {7, 8}, {10, 11},
+                {1, 3}, {2, 4}, {5, 6}, {9, 10},
+                {1, 2}, {3, 4}, {5, 7}, {6, 8},
+                {2, 3}, {4, 5}, {6, 7}, {8, 9},
+                {3, 4}, {5, 6}
+            } };
+        };
+
+        template<>
+        struct sorting_network<14> {
+            static constexpr std::array<comparator_pair, 51> pairs = { {
+                {0, 13}, {1, 12}, {4, 8}, {5, 6}, {7, 11}, {9, 10},
+                {0, 5}, {1, 7}, {2, 9}, {3, 4}, {6, 13}, {11, 12},
+                {0, 1}, {2, 3}, {4, 5}, {6, 8}, {7, 9}, {10, 11}, {12, 13},
+                {0, 2}, {1, 3}, {4, 10}, {5, 11}, {6, 7}, {8, 9},
+                {1, 2}, {3, 12}, {4, 6}, {5, 7}, {8, 10}, {9, 11},
+                {1, 4}, {2, 6}, {5, 8}, {7, 10}, {9, 13},
+                {2, 4}, {3, 6}, {9, 12}, {11, 13},
+                {3, 5}, {6, 8}, {7, 9}, {10, 12},
+                {3, 4}, {5, 6}, {7, 8}, {9, 10}, {11, 12},
+                {6, 7}, {8, 9}
+            } };
+        };
+
+        template<>
+        struct sorting_network<15> {
+            static constexpr std::array<comparator_pair, 56> pairs = { {
+                {0, 13}, {1, 12}, {3, 14}, {4, 8}, {5, 6}, {7, 11}, {9, 10},
+                {0, 5}, {1, 7}, {2, 9}, {3, 4}, {6, 13}, {8, 14}, {11, 12},
+                {0, 1}, {2, 3}, {4, 5}, {6, 8}, {7, 9}, {10, 11}, {12, 13},
+                {0, 2}, {1, 3}, {4, 10}, {5, 11}, {6, 7}, {8, 9}, {12, 14},
+                {1, 2}, {3, 12}, {4, 6}, {5, 7}, {8, 10}, {9, 11}, {13, 14},
+                {1, 4}, {2, 6}, {5, 8}, {7, 10}, {9, 13}, {11, 14},
+                {2, 4}, {3, 6}, {9, 12}, {11, 13},
+                {3, 5}, {6, 8}, {7, 9}, {10, 12},
+                {3, 4}, {5, 6}, {7, 8}, {9, 10}, {11, 12},
+                {6, 7}, {8, 9}
+            } };
+        };
+
+        template<>
+        struct sorting_network<16> {
+            static constexpr std::array<comparator_pair, 60> pairs = { {
+                {0, 13}, {1, 12}, {2, 15}, {3, 14}, {4, 8}, {5, 6}, {7, 11}, {9, 10},
+                {0, 5}, {1, 7}, {2, 9}, {3, 4}, {6, 13}, {8, 14}, {10, 15}, {11, 12},
+                {0, 1}, {2, 3}, {4, 5}, {6, 8}, {7, 9}, {10, 11}, {12, 13}, {14, 15},
+                {0, 2}, {1, 3}, {4, 10}, {5, 11}, {6, 7}, {8, 9}, {12, 14}, {13, 15},
+                {1, 2}, {3, 12}, {4, 6}, {5, 7}, {8, 10}, {9, 11}, {13, 14},
+                {1, 4}, {2, 6}, {5, 8}, {7, 10}, {9, 13}, {11, 14},
+                {2, 4}, {3, 6}, {9, 12}, {11, 13},
+                {3, 5}, {6, 8}, {7, 9}, {10, 12},
+                {3, 4}, {5, 6}, {7, 8}, {9, 10}, {11, 12},
+                {6, 7}, {8, 9}
+            } };
+        };
+
+        /// Conditional swap that puts the smaller element into a. Written with
+        /// selects instead of a branch when T is cheap to copy.
+        template<typename T, typename Compare>
+        constexpr void compare_exchange(T& a, T& b, Compare& comp) {
+            if constexpr (use_sorting_network<T>::value) {
+                const bool swap = comp(b, a);
+                const T lo = swap ? b : a;
+                const T hi = swap ? a : b;
+                a = lo;
+                b = hi;
+            }
+            else {
+                if (comp(b, a)) std::swap(a, b);
+            }
+        }
+
+        /// Network of size N fully unrolled: every comparator index is a constant.
+        template<std::size_t N, typename T, typename Compare>
+        constexpr void network_sort(T* first, Compare& comp) {
+            constexpr auto& pairs = sorting_network<N>::pairs;
+            [&]<std::size_t... I>(std::index_sequence<I...>) {
+                (compare_exchange(first[pairs[I].lo], first[pairs[I].hi], comp), ...);
+            }(std::make_index_sequence<pairs.size()>{});
+        }
+
+        template<typename T, typename Compare>
+        using network_sort_fn = void (*)(T*, Compare&);
+
+        template<typename T, typename Compare, std::size_t... N>
+        constexpr std::array<network_sort_fn<T, Compare>, sizeof...(N)> make_network_table(std::index_sequence<N...>) {
+            return { &network_sort<N, T, Compare>... };
+        }
+
+        /// Jump table from range length to its network.
+        template<typename T, typename Compare>
+        constexpr std::array<network_sort_fn<T, Compare>, max_network_size + 1> network_table =
+            make_network_table<T, Compare>(std::make_index_sequence<max_network_size + 1>{});
+
+    }
+
+    /// Sort a short range: sorting network when it fits and T is cheap to copy,
+    /// insertion sort otherwise.
+    template<typename T, typename Compare>
+    constexpr void small_sort(T* first, T* last, Compare comp) {
+        if constexpr (use_sorting_network<T>::value) {
+            if (last - first <= max_network_size) {
+                detail::network_table<T, Compare>[last - first](first, comp);
+                return;
+            }
+        }
+        insertion_sort(first, last, comp);
+    }
+
     /// Find median pivot point of *a, *b, *c according to comp.
     template<typename T, typename Compare>
-    T* get_median_of_three(T* a, T* b, T* c, Compare comp) {
+    constexpr T* get_median_of_three(T* a, T* b, T* c, Compare comp) {
         if (comp(*a, *b)) {
             // a < b
             if (comp(*b, *c)) {
@@ -45,67 +505,2316 @@ namespace qs {
         }
     }
 
-    /// Hoare's partitioning but with setting pivot at last index.
+    /// Comparators that are cheap and branch-free on arithmetic keys. These get
+    /// the block partition, specialize for your own comparator type to opt in.
     template<typename T, typename Compare>
-    T* partition(T* first, T* last, Compare comp) {
-        T* mid = first + (last - first) / 2;
-        T* pivot = get_median_of_three(first, mid, last - 1, comp);
-        // move pivot to last-1
-        std::swap(*pivot, *(last - 1));
+    struct is_cheap_compare : std::bool_constant<std::is_arithmetic_v<T> && (
+        std::is_same_v<Compare, std::less<T>> || std::is_same_v<Compare, std::less<>> ||
+        std::is_same_v<Compare, std::greater<T>> || std::is_same_v<Compare, std::greater<>>)> {
+    };
+
+    template<typename T, typename Compare>
+    struct is_cheap_compare<T, detail::counting_compare<Compare>> : is_cheap_compare<T, Compare> {
+    };
+
+    /// Hoare scan of [first, last) around a pivot stored outside of the range.
+    /// Returns split point: [first, split) <= pivot and [split, last) >= pivot.
+    template<typename T, typename Compare>
+    constexpr T* partition_hoare(T* first, T* last, const T& pivot, Compare comp) {
+        if (first == last) return first;
 
         T* left = first;
-        // because last-1 is pivot
-        T* right = last - 2;
+        T* right = last - 1;
 
         while (true) {
             // move right
-            while (left <= right && comp(*left, *(last - 1))) ++left;
+            while (left <= right && comp(*left, pivot)) ++left;
             // move left
-            while (right >= left && comp(*(last - 1), *right)) --right;
+            while (right >= left && comp(pivot, *right)) --right;
             if (left >= right) break;
             std::swap(*left, *right);
+            detail::count_swaps(1);
             ++left;
             --right;
         }
-        // move pivot into its final position
-        std::swap(*left, *(last - 1));
         return left;
     }
 
+    // elements classified per side between two swap rounds, offsets fit in a byte
+    constexpr std::ptrdiff_t partition_block_size = 64;
+
+    /// BlockQuicksort partition (Edelkamp & Weiss) with the same contract as
+    /// partition_hoare. Comparison results of a whole block are stored as offsets
+    /// without branching, then the misplaced elements of both sides are swapped.
     template<typename T, typename Compare>
-    void sort(T* first, T* last, Compare comp, bool use_insertion_sort) {
-        // value between 5 to 15 is likely to work well. 
-        // https://algs4.cs.princeton.edu/23quicksort/
-        const std::size_t insertion_threshold = 10;
+    constexpr T* partition_block(T* first, T* last, const T& pivot, Compare comp) {
+        const std::ptrdiff_t block = partition_block_size;
+        unsigned char offsets_left[partition_block_size] = {};
+        unsigned char offsets_right[partition_block_size] = {};
+        std::ptrdiff_t num_left = 0, num_right = 0;
+        std::ptrdiff_t start_left = 0, start_right = 0;
 
-        // iteration + recursion on smaller partition
-        while (last - first > insertion_threshold) {
-            T* pivot = partition(first, last, comp);
+        // [left, right) is not partitioned yet
+        T* left = first;
+        T* right = last;
 
-            // determine lengths
-            int64_t left_size = pivot - first;
-            int64_t right_size = last - (pivot + 1);
+        while (right - left > 2 * block) {
+            if (num_left == 0) {
+                // offsets of elements that belong to the right side
+                start_left = 0;
+                for (std::ptrdiff_t i = 0; i < block; ++i) {
+                    offsets_left[num_left] = static_cast<unsigned char>(i);
+                    num_left += !comp(left[i], pivot);
+                }
+            }
+            if (num_right == 0) {
+                // offsets (counted from the end) of elements that belong left
+                start_right = 0;
+                for (std::ptrdiff_t i = 0; i < block; ++i) {
+                    offsets_right[num_right] = static_cast<unsigned char>(i);
+                    num_right += !comp(pivot, *(right - 1 - i));
+                }
+            }
 
-            // recurse on small half
-            if (left_size < right_size) {
-                if (left_size > 0) sort(first, pivot, comp, use_insertion_sort);
-                // continue with right half
-                first = pivot + 1;
+            const std::ptrdiff_t num = std::min(num_left, num_right);
+            for (std::ptrdiff_t k = 0; k < num; ++k) {
+                std::swap(left[offsets_left[start_left + k]], *(right - 1 - offsets_right[start_right + k]));
             }
-            else {
-                if (right_size > 0) sort(pivot + 1, last, comp, use_insertion_sort);
-                // continue with left half
-                last = pivot;
+            detail::count_swaps(num);
+            num_left -= num;
+            num_right -= num;
+            start_left += num;
+            start_right += num;
+
+            // a block is done once all its misplaced elements were swapped out
+            if (num_left == 0) left += block;
+            if (num_right == 0) right -= block;
+        }
+
+        // at most two blocks are left, finish them with the plain scan
+        return partition_hoare(left, right, pivot, comp);
+    }
+
+    /// Keys with a vectorized partition kernel: 32/64-bit signed integers, float
+    /// and double, ordered by std::less.
+    template<typename T, typename Compare>
+    struct has_simd_partition : std::bool_constant<QS_X86_SIMD &&
+        (std::is_same_v<Compare, std::less<T>> || std::is_same_v<Compare, std::less<>>) &&
+        ((std::is_integral_v<T> && std::is_signed_v<T> && (sizeof(T) == 4 || sizeof(T) == 8)) ||
+            std::is_same_v<T, float> || std::is_same_v<T, double>)> {
+    };
+
+    template<typename T, typename Compare>
+    struct has_simd_partition<T, detail::counting_compare<Compare>> : has_simd_partition<T, Compare> {
+    };
+
+#if QS_X86_SIMD
+#if defined(_MSC_VER) && !defined(__clang__)
+#define QS_TARGET_AVX2
+#define QS_TARGET_AVX512
+#define QS_ALWAYS_INLINE __forceinline
+#else
+#define QS_TARGET_AVX2 __attribute__((target("avx2")))
+#define QS_TARGET_AVX512 __attribute__((target("avx512f")))
+#define QS_ALWAYS_INLINE inline __attribute__((always_inline))
+// simd_partition passes vectors around without a target of its own, but it is
+// always inlined into a targeted caller, so the ABI note does not apply
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+    namespace detail {
+
+        enum class simd_level { none, avx2, avx512 };
+
+        /// Best instruction set supported by both the CPU and the OS, checked once.
+        inline simd_level detect_simd_level() {
+#if defined(_MSC_VER) && !defined(__clang__)
+            int info[4];
+            __cpuid(info, 1);
+            const bool osxsave = (info[2] & (1 << 27)) != 0;
+            const bool avx = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx) return simd_level::none;
+            const unsigned long long xcr0 = _xgetbv(0);
+            if ((xcr0 & 0x6) != 0x6) return simd_level::none;
+            __cpuidex(info, 7, 0);
+            const bool avx2 = (info[1] & (1 << 5)) != 0;
+            const bool avx512f = (info[1] & (1 << 16)) != 0;
+            if (avx512f && (xcr0 & 0xE6) == 0xE6) return simd_level::avx512;
+            return avx2 ? simd_level::avx2 : simd_level::none;
+#else
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f")) return simd_level::avx512;
+            if (__builtin_cpu_supports("avx2")) return simd_level::avx2;
+            return simd_level::none;
+#endif
+        }
+
+        inline simd_level cpu_simd_level() {
+            static const simd_level level = detect_simd_level();
+            return level;
+        }
+
+        /// Shuffle indices that move the lanes selected by a mask to the front.
+        /// lut32 is for 8 lanes of 32 bits, lut64 for 4 lanes of 64 bits (as pairs).
+        struct permutation_table {
+            alignas(32) std::uint32_t lut32[256][8];
+            alignas(32) std::uint32_t lut64[16][8];
+        };
+
+        constexpr permutation_table make_permutation_table() {
+            permutation_table table{};
+            for (unsigned mask = 0; mask < 256; ++mask) {
+                unsigned k = 0;
+                for (unsigned i = 0; i < 8; ++i) if (mask & (1u << i)) table.lut32[mask][k++] = i;
+                for (unsigned i = 0; i < 8; ++i) if (!(mask & (1u << i))) table.lut32[mask][k++] = i;
+            }
+            for (unsigned mask = 0; mask < 16; ++mask) {
+                unsigned k = 0;
+                for (unsigned i = 0; i < 4; ++i) if (mask & (1u << i)) { table.lut64[mask][k++] = 2 * i; table.lut64[mask][k++] = 2 * i + 1; }
+                for (unsigned i = 0; i < 4; ++i) if (!(mask & (1u << i))) { table.lut64[mask][k++] = 2 * i; table.lut64[mask][k++] = 2 * i + 1; }
+            }
+            return table;
+        }
+
+        inline constexpr permutation_table permutations = make_permutation_table();
+
+        /// AVX2 kernel: 8 x 32-bit or 4 x 64-bit lanes. The lanes below the pivot
+        /// are shuffled to the front through the permutation table, then the whole
+        /// vector is stored at both write cursors.
+        template<typename T>
+        struct avx2_kernel {
+            using vector = __m256i;
+
+            QS_TARGET_AVX2 static vector load(const T* p) {
+                return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            }
+
+            QS_TARGET_AVX2 static vector broadcast(T value) {
+                if constexpr (std::is_same_v<T, float>) return _mm256_castps_si256(_mm256_set1_ps(value));
+                else if constexpr (std::is_same_v<T, double>) return _mm256_castpd_si256(_mm256_set1_pd(value));
+                else if constexpr (sizeof(T) == 4) return _mm256_set1_epi32(static_cast<int>(value));
+                else return _mm256_set1_epi64x(static_cast<long long>(value));
+            }
+
+            /// Bit i is set when lane i of v is less than the pivot.
+            QS_TARGET_AVX2 static unsigned less_mask(vector v, vector pivot) {
+                if constexpr (std::is_same_v<T, float>) {
+                    return _mm256_movemask_ps(_mm256_cmp_ps(_mm256_castsi256_ps(v), _mm256_castsi256_ps(pivot), _CMP_LT_OQ));
+                }
+                else if constexpr (std::is_same_v<T, double>) {
+                    return _mm256_movemask_pd(_mm256_cmp_pd(_mm256_castsi256_pd(v), _mm256_castsi256_pd(pivot), _CMP_LT_OQ));
+                }
+                else if constexpr (sizeof(T) == 4) {
+                    return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(pivot, v)));
+                }
+                else {
+                    return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(pivot, v)));
+                }
+            }
+
+            QS_TARGET_AVX2 static void store_partitioned(vector v, vector pivot, T*& write_left, T*& write_right) {
+                constexpr int lanes = sizeof(vector) / sizeof(T);
+                const unsigned mask = less_mask(v, pivot);
+                const __m256i index = _mm256_load_si256(reinterpret_cast<const __m256i*>(
+                    sizeof(T) == 4 ? permutations.lut32[mask] : permutations.lut64[mask]));
+                const __m256i packed = _mm256_permutevar8x32_epi32(v, index);
+                const int less = std::popcount(mask);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(write_left), packed);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(write_right - lanes), packed);
+                write_left += less;
+                write_right -= lanes - less;
+            }
+        };
+
+        /// AVX-512 kernel: both groups are compressed to the front of a register,
+        /// the lower one is stored full width and the upper one with a masked store.
+        template<typename T>
+        struct avx512_kernel {
+            using vector = __m512i;
+
+            QS_TARGET_AVX512 static vector load(const T* p) {
+                return _mm512_loadu_si512(p);
+            }
+
+            QS_TARGET_AVX512 static vector broadcast(T value) {
+                if constexpr (std::is_same_v<T, float>) return _mm512_castps_si512(_mm512_set1_ps(value));
+                else if constexpr (std::is_same_v<T, double>) return _mm512_castpd_si512(_mm512_set1_pd(value));
+                else if constexpr (sizeof(T) == 4) return _mm512_set1_epi32(static_cast<int>(value));
+                else return _mm512_set1_epi64(static_cast<long long>(value));
+            }
+
+            QS_TARGET_AVX512 static unsigned less_mask(vector v, vector pivot) {
+                if constexpr (std::is_same_v<T, float>) {
+                    return _mm512_cmp_ps_mask(_mm512_castsi512_ps(v), _mm512_castsi512_ps(pivot), _CMP_LT_OQ);
+                }
+                else if constexpr (std::is_same_v<T, double>) {
+                    return _mm512_cmp_pd_mask(_mm512_castsi512_pd(v), _mm512_castsi512_pd(pivot), _CMP_LT_OQ);
+                }
+                else if constexpr (sizeof(T) == 4) {
+                    return _mm512_cmplt_epi32_mask(v, pivot);
+                }
+                else {
+                    return _mm512_cmplt_epi64_mask(v, pivot);
+                }
+            }
+
+            QS_TARGET_AVX512 static void store_partitioned(vector v, vector pivot, T*& write_left, T*& write_right) {
+                constexpr int lanes = sizeof(vector) / sizeof(T);
+                const unsigned mask = less_mask(v, pivot);
+                const int less = std::popcount(mask);
+                const int greater = lanes - less;
+                if constexpr (sizeof(T) == 4) {
+                    const __mmask16 m = static_cast<__mmask16>(mask);
+                    _mm512_storeu_si512(write_left, _mm512_maskz_compress_epi32(m, v));
+                    _mm512_mask_storeu_epi32(write_right - greater, static_cast<__mmask16>((1u << greater) - 1),
+                        _mm512_maskz_compress_epi32(static_cast<__mmask16>(~m), v));
+                }
+                else {
+                    const __mmask8 m = static_cast<__mmask8>(mask);
+                    _mm512_storeu_si512(write_left, _mm512_maskz_compress_epi64(m, v));
+                    _mm512_mask_storeu_epi64(write_right - greater, static_cast<__mmask8>((1u << greater) - 1),
+                        _mm512_maskz_compress_epi64(static_cast<__mmask8>(~m), v));
+                }
+                write_left += less;
+                write_right -= greater;
             }
+        };
+
+        /// In-place vectorized partition with the contract of partition_hoare. One
+        /// vector is preloaded from each end to open free space; every following
+        /// vector is read from the side with less free space left, so the stores
+        /// of both sides never reach elements that were not read yet.
+        /// Unlike partition_hoare, every element equal to the pivot goes right, so
+        /// a range with many copies of the pivot splits one-sided. The callers'
+        /// checks for a pivot equal to the lower bound gather such runs instead.
+        template<typename Kernel, typename T>
+        QS_ALWAYS_INLINE T* simd_partition(T* first, T* last, T pivot) {
+            using vector = typename Kernel::vector;
+            constexpr std::ptrdiff_t lanes = sizeof(vector) / sizeof(T);
+            if (last - first < 2 * lanes) return partition_block(first, last, pivot, std::less<T>());
+
+            const vector pivot_vector = Kernel::broadcast(pivot);
+            const vector left_vector = Kernel::load(first);
+            const vector right_vector = Kernel::load(last - lanes);
+            T* read_left = first + lanes;
+            T* read_right = last - lanes;
+            T* write_left = first;
+            T* write_right = last;
+
+            while (read_right - read_left >= lanes) {
+                vector v;
+                if (read_left - write_left <= write_right - read_right) {
+                    v = Kernel::load(read_left);
+                    read_left += lanes;
+                }
+                else {
+                    read_right -= lanes;
+                    v = Kernel::load(read_right);
+                }
+                Kernel::store_partitioned(v, pivot_vector, write_left, write_right);
+            }
+
+            // less than one vector left, copy it out and place it element by element
+            T tail[lanes];
+            const std::ptrdiff_t tail_size = read_right - read_left;
+            std::copy(read_left, read_right, tail);
+            for (std::ptrdiff_t i = 0; i < tail_size; ++i) {
+                if (tail[i] < pivot) *write_left++ = tail[i];
+                else *--write_right = tail[i];
+            }
+
+            // exactly two vectors of free space remain for the preloaded ones
+            Kernel::store_partitioned(left_vector, pivot_vector, write_left, write_right);
+            Kernel::store_partitioned(right_vector, pivot_vector, write_left, write_right);
+            return write_left;
+        }
+
+        template<typename T>
+        QS_TARGET_AVX2 T* partition_avx2(T* first, T* last, T pivot) {
+            return simd_partition<avx2_kernel<T>>(first, last, pivot);
+        }
+
+        template<typename T>
+        QS_TARGET_AVX512 T* partition_avx512(T* first, T* last, T pivot) {
+            return simd_partition<avx512_kernel<T>>(first, last, pivot);
+        }
+
+    }
+#if !defined(_MSC_VER) || defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+    /// Split [first, last) around pivot. The partition scheme is picked at
+    /// compile time, for SIMD-capable keys the kernel is chosen by CPUID.
+    template<typename T, typename Compare>
+    constexpr T* partition_around(T* first, T* last, const T& pivot, Compare comp) {
+#if QS_X86_SIMD
+        if constexpr (has_simd_partition<T, Compare>::value) {
+            // intrinsics can't be constant evaluated, the scalar schemes can
+            if (std::is_constant_evaluated()) return partition_block(first, last, pivot, comp);
+            const detail::simd_level level = detail::cpu_simd_level();
+            if (level != detail::simd_level::none) detail::count_comparisons(last - first);
+            if (level == detail::simd_level::avx512) return detail::partition_avx512(first, last, pivot);
+            if (level == detail::simd_level::avx2) return detail::partition_avx2(first, last, pivot);
         }
+#endif
+        if constexpr (is_cheap_compare<T, Compare>::value) {
+            return partition_block(first, last, pivot, comp);
+        }
+        else {
+            return partition_hoare(first, last, pivot, comp);
+        }
+    }
 
-        if (!use_insertion_sort) {
-            std::sort(first, last, comp);
+    /// Pick a pivot and move it to last-1. Median of three for small ranges,
+    /// Tukey's ninther (median of three medians) above 128 elements, which is
+    /// much harder to push towards the extremes with crafted input.
+    template<typename T, typename Compare>
+    constexpr void select_pivot(T* first, T* last, Compare comp) {
+        const std::ptrdiff_t size = last - first;
+        T* mid = first + size / 2;
+        T* pivot;
+        if (size > 128) {
+            const std::ptrdiff_t step = size / 8;
+            T* a = get_median_of_three(first, first + step, first + 2 * step, comp);
+            T* b = get_median_of_three(mid - step, mid, mid + step, comp);
+            T* c = get_median_of_three(last - 1 - 2 * step, last - 1 - step, last - 1, comp);
+            pivot = get_median_of_three(a, b, c, comp);
         }
         else {
-            // for small partitions use insertion sort
-            insertion_sort(first, last, comp);
+            pivot = get_median_of_three(first, mid, last - 1, comp);
+        }
+        std::swap(*pivot, *(last - 1));
+    }
+
+    namespace detail {
+
+        /// Partition with the pivot already placed at last-1.
+        template<typename T, typename Compare>
+        constexpr T* partition_selected(T* first, T* last, Compare comp) {
+            // because last-1 is pivot
+            T* left = partition_around(first, last - 1, *(last - 1), comp);
+            // move pivot into its final position
+            std::swap(*left, *(last - 1));
+            return left;
+        }
+
+        /// Dutch national flag partition with the pivot already placed at last-1.
+        template<typename T, typename Compare>
+        constexpr std::pair<T*, T*> partition_three_way_selected(T* first, T* last, Compare comp) {
+            // [first, lt) < pivot, [lt, i) == pivot, [i, gt) unknown, [gt, last-1) > pivot
+            T* lt = first;
+            T* i = first;
+            T* gt = last - 1;
+            while (i < gt) {
+                if (comp(*i, *(last - 1))) {
+                    std::swap(*lt, *i);
+                    count_swaps(1);
+                    ++lt;
+                    ++i;
+                }
+                else if (comp(*(last - 1), *i)) {
+                    --gt;
+                    std::swap(*i, *gt);
+                    count_swaps(1);
+                }
+                else {
+                    ++i;
+                }
+            }
+            // move pivot to the end of the equal run
+            if (gt != last - 1) std::swap(*gt, *(last - 1));
+            return { lt, gt + 1 };
+        }
+
+    }
+
+    /// Hoare's partitioning but with setting pivot at last index.
+    template<typename T, typename Compare>
+    constexpr T* partition(T* first, T* last, Compare comp) {
+        // move pivot to last-1
+        select_pivot(first, last, comp);
+        return detail::partition_selected(first, last, comp);
+    }
+
+    /// Three-way partitioning. Returns [lt, gt), the run of elements equal to
+    /// the pivot; [first, lt) is less and [gt, last) is greater than the pivot.
+    template<typename T, typename Compare>
+    constexpr std::pair<T*, T*> partition_three_way(T* first, T* last, Compare comp) {
+        select_pivot(first, last, comp);
+        return detail::partition_three_way_selected(first, last, comp);
+    }
+
+    /// Heapsort, the O(n log n) fallback once quicksort runs out of good pivots.
+    template<typename T, typename Compare>
+    constexpr void heap_sort(T* first, T* last, Compare comp) {
+        std::make_heap(first, last, comp);
+        std::sort_heap(first, last, comp);
+    }
+
+    /// Default cutoffs, used for element types without an entry in the tuning
+    /// file. Ranges up to insertion_threshold elements are left to small_sort;
+    /// a value between 5 and 15 is likely to work well for cheap keys.
+    /// https://algs4.cs.princeton.edu/23quicksort/
+    constexpr std::ptrdiff_t insertion_threshold = 10;
+
+    /// qs::sort hands ranges of radix sortable keys ordered by std::less to
+    /// radix_sort from this size on.
+    constexpr std::ptrdiff_t radix_sort_threshold = 1 << 16;
+
+    // partitions at or below this size are never split further between threads
+    constexpr std::ptrdiff_t parallel_cutoff = 1 << 14;
+
+    /// Cutoffs of qs::sort and qs::parallel_sort for one element type.
+    struct sort_tuning {
+        std::ptrdiff_t insertion_threshold = qs::insertion_threshold;
+        std::ptrdiff_t parallel_cutoff = qs::parallel_cutoff;
+        std::ptrdiff_t radix_threshold = qs::radix_sort_threshold;
+    };
+
+    /// Name of T in the tuning file: i32, u64, f64, string, or objectN for other
+    /// types of N bytes.
+    template<typename T>
+    std::string tuning_key() {
+        if constexpr (std::is_floating_point_v<T>) return "f" + std::to_string(8 * sizeof(T));
+        else if constexpr (std::is_integral_v<T>) return (std::is_signed_v<T> ? "i" : "u") + std::to_string(8 * sizeof(T));
+        else if constexpr (std::is_same_v<T, std::string>) return "string";
+        else return "object" + std::to_string(sizeof(T));
+    }
+
+    namespace detail {
+
+        using tuning_map = std::map<std::string, sort_tuning>;
+
+        /// Lines of "key insertion_threshold parallel_cutoff radix_threshold",
+        /// '#' starts a comment. Malformed lines are skipped. Throws
+        /// std::runtime_error if the file cannot be opened.
+        inline tuning_map read_tuning_file(const std::filesystem::path& path) {
+            tuning_map entries;
+            std::ifstream file(path);
+            if (!file) throw std::runtime_error("load_tuning: cannot read " + path.string());
+            for (std::string line; std::getline(file, line);) {
+                if (line.empty() || line[0] == '#') continue;
+                std::istringstream fields(line);
+                std::string key;
+                sort_tuning tuning;
+                if (fields >> key >> tuning.insertion_threshold >> tuning.parallel_cutoff >> tuning.radix_threshold &&
+                    tuning.insertion_threshold > 1 && tuning.parallel_cutoff > 0 && tuning.radix_threshold > 0) {
+                    entries[key] = tuning;
+                }
+            }
+            return entries;
+        }
+
+        /// Entries of the last load_tuning, empty until then.
+        inline tuning_map& loaded_tuning() {
+            static tuning_map entries;
+            return entries;
+        }
+
+        /// Guards loaded_tuning and tuning_resolvers.
+        inline std::mutex& tuning_mutex() {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        /// One function per element type whose cutoffs were looked up, which
+        /// looks them up again after load_tuning.
+        inline std::vector<void (*)()>& tuning_resolvers() {
+            static std::vector<void (*)()> resolvers;
+            return resolvers;
+        }
+
+        /// Entry for T; types without one of their own use the calibrated object
+        /// type closest in size, then the defaults.
+        template<typename T>
+        sort_tuning lookup_tuning() {
+            const tuning_map& entries = loaded_tuning();
+            const auto exact = entries.find(tuning_key<T>());
+            if (exact != entries.end()) return exact->second;
+            if constexpr (!std::is_arithmetic_v<T> && !std::is_same_v<T, std::string>) {
+                const sort_tuning* nearest = nullptr;
+                std::size_t best = std::numeric_limits<std::size_t>::max();
+                for (const auto& [key, tuning] : entries) {
+                    if (key.rfind("object", 0) != 0) continue;
+                    const std::size_t size = std::strtoull(key.c_str() + 6, nullptr, 10);
+                    const std::size_t distance = size > sizeof(T) ? size - sizeof(T) : sizeof(T) - size;
+                    if (distance < best) {
+                        best = distance;
+                        nearest = &tuning;
+                    }
+                }
+                if (nearest) return *nearest;
+            }
+            return sort_tuning();
+        }
+
+        template<typename T>
+        sort_tuning& tuning_storage() {
+            static sort_tuning tuning = [] {
+                std::lock_guard<std::mutex> lock(tuning_mutex());
+                tuning_resolvers().push_back([] { tuning_storage<T>() = lookup_tuning<T>(); });
+                return lookup_tuning<T>();
+            }();
+            return tuning;
+        }
+
+    }
+
+    /// Cutoffs qs::sort uses for T: those of the last load_tuning, otherwise the
+    /// defaults. sort reads them once per call.
+    template<typename T>
+    const sort_tuning& tuning_for() {
+        return detail::tuning_storage<T>();
+    }
+
+    /// Override the cutoffs for T in this process, as calibration does. Must
+    /// not race with sorts of T running on other threads.
+    template<typename T>
+    void set_tuning(const sort_tuning& tuning) {
+        detail::tuning_storage<T>() = tuning;
+    }
+
+    /// Replace the cutoffs of every element type with those in a file written by
+    /// save_tuning. Types without an entry get the defaults again, set_tuning
+    /// overrides are dropped. Nothing is read unless this is called. Must not
+    /// race with sorts on other threads. Throws std::runtime_error if the file
+    /// cannot be read.
+    inline void load_tuning(const std::filesystem::path& path) {
+        detail::tuning_map entries = detail::read_tuning_file(path);
+        std::lock_guard<std::mutex> lock(detail::tuning_mutex());
+        detail::loaded_tuning() = std::move(entries);
+        for (void (*resolve)() : detail::tuning_resolvers()) resolve();
+    }
+
+    /// Write entries in the format load_tuning reads. Throws std::runtime_error
+    /// if the file cannot be written.
+    inline void save_tuning(const std::filesystem::path& path, const std::map<std::string, sort_tuning>& entries) {
+        std::ofstream file(path);
+        file << "# key insertion_threshold parallel_cutoff radix_threshold\n";
+        for (const auto& [key, tuning] : entries) {
+            file << key << ' ' << tuning.insertion_threshold << ' ' << tuning.parallel_cutoff << ' ' << tuning.radix_threshold << '\n';
+        }
+        if (!file) throw std::runtime_error("save_tuning: cannot write " + path.string());
+    }
+
+    namespace detail {
+
+        /// Largest range sort_loop leaves to small_sort. Constant evaluation can't
+        /// read the loaded tuning and uses the default.
+        template<typename T>
+        constexpr std::ptrdiff_t small_sort_size() {
+            return std::is_constant_evaluated() ? insertion_threshold : tuning_for<T>().insertion_threshold;
+        }
+
+        /// Number of bad partitions tolerated before switching to heapsort.
+        constexpr int bad_partition_budget(std::ptrdiff_t size) {
+            int log2 = 0;
+            while (size > 1) {
+                size >>= 1;
+                ++log2;
+            }
+            return log2;
+        }
+
+        /// A partition is bad when one side got less than 1/8 of the elements.
+        /// Swap a few elements at fixed spots in both halves (as pdqsort does),
+        /// so patterns that fooled the pivot choice are not repeated next round.
+        template<typename T>
+        constexpr bool break_bad_partition(T* first, T* pivot, T* last) {
+            const std::ptrdiff_t left_size = pivot - first;
+            const std::ptrdiff_t right_size = last - (pivot + 1);
+            const std::ptrdiff_t size = last - first;
+            if (left_size >= size / 8 && right_size >= size / 8) return false;
+
+            if (left_size >= 16) {
+                std::swap(*first, *(first + left_size / 4));
+                std::swap(*(pivot - 1), *(pivot - left_size / 4));
+            }
+            if (right_size >= 16) {
+                std::swap(*(pivot + 1), *(pivot + 1 + right_size / 4));
+                std::swap(*(last - 1), *(last - right_size / 4));
+            }
+            return true;
+        }
+
+        /// Unless leftmost, *(first - 1) is the pivot of an enclosing partition and
+        /// no element of [first, last) is less than it.
+        template<typename T, typename Compare>
+        constexpr void sort_loop(T* first, T* last, Compare comp, bool use_insertion_sort, std::ptrdiff_t small_size,
+            int bad_allowed, bool leftmost) {
+            [[maybe_unused]] recursion_level level;
+
+            // iteration + recursion on smaller partition
+            while (last - first > small_size) {
+                select_pivot(first, last, comp);
+
+                // pivot equal to the lower bound means a run of duplicates: gather all
+                // elements equal to it in one three-way pass and drop them
+                if (!leftmost && !comp(*(first - 1), *(last - 1))) {
+                    std::pair<T*, T*> equal = partition_three_way_selected(first, last, comp);
+                    count_partition(equal.first - first, last - equal.second, false);
+                    if (equal.first - first > 1) sort_loop(first, equal.first, comp, use_insertion_sort, small_size, bad_allowed, false);
+                    first = equal.second;
+                    continue;
+                }
+
+                T* pivot = partition_selected(first, last, comp);
+                const bool bad = break_bad_partition(first, pivot, last);
+                count_partition(pivot - first, last - (pivot + 1), bad);
+
+                // too many lopsided splits, quicksort is heading for O(n^2)
+                if (bad && --bad_allowed <= 0) {
+                    heap_sort(first, last, comp);
+                    return;
+                }
+
+                // determine lengths
+                int64_t left_size = pivot - first;
+                int64_t right_size = last - (pivot + 1);
+
+                // recurse on small half
+                if (left_size < right_size) {
+                    if (left_size > 0) sort_loop(first, pivot, comp, use_insertion_sort, small_size, bad_allowed, leftmost);
+                    // continue with right half
+                    first = pivot + 1;
+                    leftmost = false;
+                }
+                else {
+                    if (right_size > 0) sort_loop(pivot + 1, last, comp, use_insertion_sort, small_size, bad_allowed, false);
+                    // continue with left half
+                    last = pivot;
+                }
+            }
+
+            if (!use_insertion_sort) {
+                std::sort(first, last, comp);
+            }
+            else {
+                // for small partitions use a sorting network or insertion sort
+                small_sort(first, last, comp);
+            }
+        }
+
+    }
+
+    /// Integral (except bool) and IEEE floating-point keys can be radix sorted.
+    template<typename T>
+    struct is_radix_sortable : std::bool_constant<
+        (std::is_integral_v<T> && !std::is_same_v<T, bool>) ||
+        ((std::is_same_v<T, float> || std::is_same_v<T, double>) && std::numeric_limits<T>::is_iec559)> {
+    };
+
+    // ranges from this size on are radix sorted in place (MSD) to save the buffer
+    constexpr std::ptrdiff_t american_flag_threshold = 1 << 20;
+
+    namespace detail {
+
+        /// Unsigned integer of the same width whose order matches the order of T:
+        /// the sign bit of signed integers is flipped, negative floats have all
+        /// bits flipped and positive ones only the sign bit.
+        template<typename T>
+        auto radix_key(T value) {
+            using U = std::make_unsigned_t<std::conditional_t<std::is_same_v<T, float>, std::int32_t,
+                std::conditional_t<std::is_same_v<T, double>, std::int64_t, T>>>;
+            constexpr U sign = U(1) << (sizeof(U) * 8 - 1);
+            if constexpr (std::is_floating_point_v<T>) {
+                const U bits = std::bit_cast<U>(value);
+                return (bits & sign) ? U(~bits) : U(bits ^ sign);
+            }
+            else if constexpr (std::is_signed_v<T>) {
+                return U(static_cast<U>(value) ^ sign);
+            }
+            else {
+                return U(value);
+            }
+        }
+
+        template<typename T>
+        unsigned radix_digit(T value, unsigned shift) {
+            return static_cast<unsigned>((radix_key(value) >> shift) & 0xFF);
+        }
+
+        /// LSD radix sort with 11-bit digits (3 passes for 32-bit keys, 6 for
+        /// 64-bit ones). All histograms are counted in one pass, digits that are
+        /// equal for every key are skipped.
+        template<typename T>
+        void lsd_radix_sort(T* first, T* last) {
+            constexpr unsigned bits = 11;
+            constexpr std::size_t radix = std::size_t(1) << bits;
+            constexpr unsigned digits = (sizeof(T) * 8 + bits - 1) / bits;
+            const std::size_t n = last - first;
+
+            std::vector<std::size_t> counts(digits * radix);
+            for (T* it = first; it != last; ++it) {
+                const auto key = radix_key(*it);
+                for (unsigned d = 0; d < digits; ++d) ++counts[d * radix + ((key >> (bits * d)) & (radix - 1))];
+            }
+
+            std::unique_ptr<T[]> buffer(new T[n]);
+            T* from = first;
+            T* to = buffer.get();
+            for (unsigned d = 0; d < digits; ++d) {
+                std::size_t* count = counts.data() + d * radix;
+                if (std::find(count, count + radix, n) != count + radix) continue;
+
+                std::size_t offset = 0;
+                for (std::size_t b = 0; b < radix; ++b) {
+                    const std::size_t bucket = count[b];
+                    count[b] = offset;
+                    offset += bucket;
+                }
+                for (T* it = from; it != from + n; ++it) {
+                    to[count[(radix_key(*it) >> (bits * d)) & (radix - 1)]++] = *it;
+                }
+                std::swap(from, to);
+            }
+            if (from != first) std::copy(from, from + n, first);
+        }
+
+        /// American flag sort: in-place MSD radix sort on 8-bit digits. Elements
+        /// are permuted into their buckets by following swap cycles. Buckets that
+        /// are still large get the next digit, cache-sized ones are finished by LSD
+        /// passes and small ones by the comparison sort.
+        template<typename T>
+        void american_flag_sort(T* first, T* last, unsigned shift) {
+            const std::size_t lsd_bucket_size = 4096;
+
+            std::array<std::size_t, 256> count{};
+            for (T* it = first; it != last; ++it) ++count[radix_digit(*it, shift)];
+
+            std::array<T*, 256> head;
+            std::array<T*, 256> tail;
+            T* offset = first;
+            for (unsigned b = 0; b < 256; ++b) {
+                head[b] = offset;
+                offset += count[b];
+                tail[b] = offset;
+            }
+
+            for (unsigned b = 0; b < 256; ++b) {
+                while (head[b] != tail[b]) {
+                    T value = *head[b];
+                    unsigned d = radix_digit(value, shift);
+                    // carry value along its cycle until a slot of bucket b frees up
+                    while (d != b) {
+                        std::swap(value, *head[d]++);
+                        d = radix_digit(value, shift);
+                    }
+                    *head[b]++ = value;
+                }
+            }
+
+            if (shift == 0) return;
+            const std::ptrdiff_t small_size = small_sort_size<T>();
+            T* bucket = first;
+            for (unsigned b = 0; b < 256; ++b) {
+                T* bucket_end = bucket + count[b];
+                if (count[b] >= static_cast<std::size_t>(american_flag_threshold)) {
+                    american_flag_sort(bucket, bucket_end, shift - 8);
+                }
+                else if (count[b] >= lsd_bucket_size) {
+                    lsd_radix_sort(bucket, bucket_end);
+                }
+                else if (count[b] > 1) {
+                    sort_loop(bucket, bucket_end, std::less<T>(), true, small_size, bad_partition_budget(count[b]), true);
+                }
+                bucket = bucket_end;
+            }
+        }
+
+    }
+
+    /// Radix sort into ascending order. Uses LSD with a buffer of n elements, or
+    /// the in-place American flag sort from american_flag_threshold on.
+    template<typename T>
+    void radix_sort(T* first, T* last) {
+        static_assert(is_radix_sortable<T>::value, "radix_sort needs integral or IEEE floating-point keys");
+        if (last - first >= american_flag_threshold) {
+            detail::american_flag_sort(first, last, 8 * (sizeof(T) - 1));
+        }
+        else if (last - first > 1) {
+            detail::lsd_radix_sort(first, last);
+        }
+    }
+
+    /// Introsort: quicksort with a budget of log2(n) bad partitions, after which
+    /// the remaining range is heapsorted. O(n log n) for every input. Runs of
+    /// equal keys are split off by three-way partitions and never touched again,
+    /// so inputs with few distinct values sort in close to linear time.
+    /// Large ranges of radix sortable keys in std::less order go to radix_sort.
+    /// Builds with QS_ENABLE_STATS=1 record what the call did in last_sort_stats().
+    /// Usable in constant expressions, where it runs the scalar quicksort only.
+    template<typename T, typename Compare>
+    constexpr void sort(T* first, T* last, Compare comp, bool use_insertion_sort) {
+        [[maybe_unused]] detail::stats_scope scope;
+        if (!std::is_constant_evaluated()) {
+            if constexpr (is_radix_sortable<T>::value &&
+                (std::is_same_v<Compare, std::less<T>> || std::is_same_v<Compare, std::less<>>)) {
+                if (last - first >= tuning_for<T>().radix_threshold) {
+                    radix_sort(first, last);
+                    return;
+                }
+            }
+            if constexpr (stats_enabled) {
+                detail::sort_loop(first, last, detail::counting_compare<Compare>{ comp }, use_insertion_sort,
+                    detail::small_sort_size<T>(), detail::bad_partition_budget(last - first), true);
+                return;
+            }
+        }
+        detail::sort_loop(first, last, comp, use_insertion_sort, detail::small_sort_size<T>(),
+            detail::bad_partition_budget(last - first), true);
+    }
+
+    namespace detail {
+
+        template<typename It, typename Compare>
+        constexpr void iterator_insertion_sort(It first, It last, Compare comp) {
+            if (first == last) return;
+            for (It it = first + 1; it != last; ++it) {
+                auto value = std::move(*it);
+                It hole = it;
+                for (; hole != first && comp(value, *(hole - 1)); --hole) {
+                    *hole = std::move(*(hole - 1));
+                }
+                *hole = std::move(value);
+            }
+        }
+
+        // Introsort for random-access iterators that are not contiguous, such as
+        // std::deque's: median-of-three pivot, Sedgewick's partition, and a
+        // heapsort once 2 log2(n) levels are used up.
+        template<typename It, typename Compare>
+        constexpr void iterator_sort_loop(It first, It last, Compare comp, bool use_insertion_sort, std::ptrdiff_t small_size,
+            int depth) {
+            while (last - first > small_size) {
+                if (depth-- == 0) {
+                    std::make_heap(first, last, comp);
+                    std::sort_heap(first, last, comp);
+                    return;
+                }
+                It mid = first + (last - first) / 2;
+                if (comp(*mid, *first)) std::iter_swap(mid, first);
+                if (comp(*(last - 1), *mid)) {
+                    std::iter_swap(last - 1, mid);
+                    if (comp(*mid, *first)) std::iter_swap(mid, first);
+                }
+                // the median becomes the pivot at first, *(last - 1) stops the left scan
+                std::iter_swap(first, mid);
+                It i = first;
+                It j = last;
+                for (;;) {
+                    do ++i; while (comp(*i, *first));
+                    do --j; while (comp(*first, *j));
+                    if (i >= j) break;
+                    std::iter_swap(i, j);
+                }
+                std::iter_swap(first, j);
+
+                if (j - first < last - (j + 1)) {
+                    iterator_sort_loop(first, j, comp, use_insertion_sort, small_size, depth);
+                    first = j + 1;
+                }
+                else {
+                    iterator_sort_loop(j + 1, last, comp, use_insertion_sort, small_size, depth);
+                    last = j;
+                }
+            }
+            if (!use_insertion_sort) {
+                std::sort(first, last, comp);
+            }
+            else {
+                iterator_insertion_sort(first, last, comp);
+            }
+        }
+    }
+
+    /// qs::sort over any random-access iterators. Contiguous iterators (pointers,
+    /// std::vector, std::array, Array<T>) are sorted through the T* overload and
+    /// get all of its kernels; other iterators go to a plain introsort.
+    template<std::random_access_iterator It, typename Compare = std::less<>>
+    constexpr void sort(It first, It last, Compare comp = Compare(), bool use_insertion_sort = true) {
+        if constexpr (std::contiguous_iterator<It>) {
+            auto* data = std::to_address(first);
+            sort(data, data + (last - first), comp, use_insertion_sort);
+        }
+        else {
+            const auto n = static_cast<std::size_t>(last - first);
+            detail::iterator_sort_loop(first, last, comp, use_insertion_sort, detail::small_sort_size<std::iter_value_t<It>>(),
+                2 * static_cast<int>(std::bit_width(n)));
+        }
+    }
+
+    /// qs::sort over a random-access range, sorted in place.
+    template<std::ranges::random_access_range R, typename Compare = std::less<>>
+    constexpr void sort(R&& range, Compare comp = Compare()) {
+        auto first = std::ranges::begin(range);
+        sort(first, std::ranges::next(first, std::ranges::end(range)), comp, true);
+    }
+
+    namespace detail {
+
+        template<typename T, typename Compare>
+        void select_loop(T* first, T* nth, T* last, Compare comp, bool median_of_medians, bool leftmost);
+
+        /// Median of medians of groups of five, moved to last-1. Costs O(n) and
+        /// leaves at least 3/10 of the range on either side of the pivot.
+        template<typename T, typename Compare>
+        void median_of_medians_pivot(T* first, T* last, Compare comp) {
+            const std::ptrdiff_t groups = (last - first) / 5;
+            for (std::ptrdiff_t g = 0; g < groups; ++g) {
+                T* group = first + 5 * g;
+                small_sort(group, group + 5, comp);
+                std::swap(first[g], group[2]);
+            }
+            // the recursion takes this path all the way down
+            select_loop(first, first + groups / 2, first + groups, comp, true, true);
+            std::swap(first[groups / 2], *(last - 1));
+        }
+
+        /// Introselect (Musser): quickselect with the sort's pivot choice, as long
+        /// as every two rounds at least halve the range. Otherwise the remaining
+        /// rounds take median of medians pivots and three-way partitions. Either
+        /// way the rounds shrink geometrically, so the whole is linear time.
+        template<typename T, typename Compare>
+        void select_loop(T* first, T* nth, T* last, Compare comp, bool median_of_medians, bool leftmost) {
+            std::ptrdiff_t checkpoint = last - first;
+            int rounds = 0;
+            while (last - first > max_network_size) {
+                T* pivot = nullptr;
+                std::pair<T*, T*> equal;
+                if (median_of_medians) {
+                    median_of_medians_pivot(first, last, comp);
+                    equal = partition_three_way_selected(first, last, comp);
+                }
+                else {
+                    select_pivot(first, last, comp);
+                    // same duplicate check as sort_loop
+                    if (!leftmost && !comp(*(first - 1), *(last - 1))) {
+                        equal = partition_three_way_selected(first, last, comp);
+                    }
+                    else {
+                        pivot = partition_selected(first, last, comp);
+                        break_bad_partition(first, pivot, last);
+                        equal = { pivot, pivot + 1 };
+                    }
+                }
+
+                if (nth < equal.first) {
+                    last = equal.first;
+                }
+                else if (nth >= equal.second) {
+                    first = equal.second;
+                    leftmost = false;
+                }
+                else {
+                    return;
+                }
+
+                if (!median_of_medians && ++rounds == 2) {
+                    if (2 * (last - first) > checkpoint) median_of_medians = true;
+                    checkpoint = last - first;
+                    rounds = 0;
+                }
+            }
+            small_sort(first, last, comp);
+        }
+
+    }
+
+    /// Rearrange [first, last) so that *nth is the element a full sort would put
+    /// there, nothing in [first, nth) is greater and nothing in (nth, last) is
+    /// less than it. Introselect, O(n) in the worst case.
+    template<typename T, typename Compare>
+    void nth_element(T* first, T* nth, T* last, Compare comp) {
+        if (nth == last || last - first < 2) return;
+        detail::select_loop(first, nth, last, comp, false, true);
+    }
+
+    /// Sort the smallest middle - first elements of [first, last) into
+    /// [first, middle); the rest is left in unspecified order. A selection
+    /// followed by a sort of the prefix, O(n + k log k) for k = middle - first.
+    template<typename T, typename Compare>
+    void partial_sort(T* first, T* middle, T* last, Compare comp) {
+        if (middle == first) return;
+        if (middle != last) nth_element(first, middle - 1, last, comp);
+        sort(first, middle, comp, true);
+    }
+
+    /// The k first elements in Compare order of a stream, kept in a bounded
+    /// max-heap: each push costs O(log k) and memory stays at k elements.
+    template<typename T, typename Compare = std::less<T>>
+    class top_k {
+    public:
+        explicit top_k(std::size_t k, Compare comp = Compare()) : m_k(k), m_comp(comp) {
+            m_heap.reserve(k);
+        }
+
+        void push(const T& value) {
+            if (m_heap.size() < m_k) {
+                m_heap.push_back(value);
+                std::push_heap(m_heap.begin(), m_heap.end(), m_comp);
+            }
+            else if (m_k > 0 && m_comp(value, m_heap.front())) {
+                // replace the worst kept element
+                std::pop_heap(m_heap.begin(), m_heap.end(), m_comp);
+                m_heap.back() = value;
+                std::push_heap(m_heap.begin(), m_heap.end(), m_comp);
+            }
+        }
+
+        template<typename It>
+        void push(It first, It last) {
+            for (; first != last; ++first) push(*first);
+        }
+
+        std::size_t size() const { return m_heap.size(); }
+        std::size_t capacity() const { return m_k; }
+
+        /// The kept elements in sorted order.
+        std::vector<T> sorted() const {
+            std::vector<T> result = m_heap;
+            std::sort_heap(result.begin(), result.end(), m_comp);
+            return result;
+        }
+
+    private:
+        std::size_t m_k;
+        Compare m_comp;
+        std::vector<T> m_heap;
+    };
+
+    /// Natural runs shorter than this are not worth a merge, adaptive_sort sorts
+    /// the stretches between longer runs with quicksort instead.
+    constexpr std::ptrdiff_t adaptive_min_run = 32;
+
+    /// Reusable uninitialized storage for the merges of adaptive_sort and
+    /// stable_sort. By default it grows on demand from a memory resource (the
+    /// heap, or an arena) and keeps its capacity between calls, so a buffer
+    /// reused across sorts allocates only until it has reached the largest size
+    /// needed. Built over caller memory it never allocates; merges that do not
+    /// fit fall back to in-place merging. Holds no elements between merges.
+    template<typename T>
+    class scratch_buffer {
+    public:
+        explicit scratch_buffer(std::pmr::memory_resource* resource = std::pmr::new_delete_resource())
+            : m_resource(resource) {
+        }
+
+        /// Fixed storage inside [memory, memory + bytes), suitably aligned for T.
+        scratch_buffer(void* memory, std::size_t bytes) {
+            if (std::align(alignof(T), sizeof(T), memory, bytes)) {
+                m_data = static_cast<T*>(memory);
+                m_capacity = bytes / sizeof(T);
+            }
+        }
+
+        scratch_buffer(const scratch_buffer&) = delete;
+        scratch_buffer& operator=(const scratch_buffer&) = delete;
+        ~scratch_buffer() { release(); }
+
+        /// Grow to at least count elements unless the storage is fixed.
+        /// Returns the capacity, which may stay below count.
+        std::size_t reserve(std::size_t count) {
+            if (count > m_capacity && m_resource) {
+                release();
+                m_data = static_cast<T*>(m_resource->allocate(count * sizeof(T), alignof(T)));
+                m_capacity = count;
+            }
+            return m_capacity;
+        }
+
+        T* data() const { return m_data; }
+        std::size_t capacity() const { return m_capacity; }
+
+    private:
+        void release() {
+            if (m_resource && m_data) m_resource->deallocate(m_data, m_capacity * sizeof(T), alignof(T));
+            m_data = nullptr;
+            m_capacity = 0;
+        }
+
+        // null for caller-provided storage
+        std::pmr::memory_resource* m_resource = nullptr;
+        T* m_data = nullptr;
+        std::size_t m_capacity = 0;
+    };
+
+    namespace detail {
+
+        /// End of the natural run starting at first. Strictly descending runs are
+        /// reversed in place, so [first, end) is ascending on return.
+        template<typename T, typename Compare>
+        T* find_run(T* first, T* last, Compare comp) {
+            T* it = first + 1;
+            if (it == last) return last;
+            if (comp(*it, *first)) {
+                while (++it != last && comp(*it, *(it - 1))) {}
+                std::reverse(first, it);
+            }
+            else {
+                while (++it != last && !comp(*it, *(it - 1))) {}
+            }
+            return it;
+        }
+
+        /// Powersort node power of the boundary between the adjacent runs
+        /// [s1, s1 + n1) and [s1 + n1, s1 + n1 + n2) of an array of n elements:
+        /// the depth at which their midpoints fall apart in a binary split of
+        /// [0, n). Computed bit by bit, without division (powerloop).
+        inline unsigned run_power(std::size_t s1, std::size_t n1, std::size_t n2, std::size_t n) {
+            unsigned power = 0;
+            // twice the midpoints of both runs, as fractions of n
+            std::size_t a = 2 * s1 + n1;
+            std::size_t b = a + n1 + n2;
+            for (;;) {
+                ++power;
+                if (a >= n) {
+                    a -= n;
+                    b -= n;
+                }
+                else if (b >= n) {
+                    return power;
+                }
+                a <<= 1;
+                b <<= 1;
+            }
+        }
+
+        /// Moves the elements still held in a merge buffer, [from, to), back into
+        /// the hole that ends (backward) or starts at out, also when a comparison
+        /// throws, then destroys the buffered elements.
+        template<typename T>
+        struct merge_guard {
+            T*& from;
+            T*& to;
+            T*& out;
+            bool backward;
+            T* buffer;
+            T* buffer_end;
+            ~merge_guard() {
+                if (backward) std::move_backward(from, to, out);
+                else std::move(from, to, out);
+                std::destroy(buffer, buffer_end);
+            }
+        };
+
+        /// Stable merge of the sorted ranges [first, mid) and [mid, last).
+        /// Elements already in place at both ends are skipped by binary search
+        /// first. The shorter run is then moved into buffer and merged in one
+        /// linear pass; without a buffer, or one too small, the runs are split at
+        /// the middle of the longer one, rotated and merged recursively in place
+        /// (O(n log n) for a single merge).
+        template<typename T, typename Compare>
+        void merge_adjacent(T* first, T* mid, T* last, Compare comp, scratch_buffer<T>* buffer) {
+            if (first == mid || mid == last || !comp(*mid, *(mid - 1))) return;
+            first = std::upper_bound(first, mid, *mid, comp);
+            last = std::lower_bound(mid, last, *(mid - 1), comp);
+            const std::size_t left_size = mid - first;
+            const std::size_t right_size = last - mid;
+
+            if (buffer && buffer->reserve(std::min(left_size, right_size)) >= std::min(left_size, right_size)) {
+                T* buf = buffer->data();
+                if (left_size <= right_size) {
+                    // buffer the left run and merge forwards
+                    T* buf_end = std::uninitialized_move(first, mid, buf);
+                    T* left = buf;
+                    T* out = first;
+                    T* right = mid;
+                    merge_guard<T> guard{ left, buf_end, out, false, buf, buf_end };
+                    while (left != buf_end && right != last) {
+                        if (comp(*right, *left)) *out++ = std::move(*right++);
+                        else *out++ = std::move(*left++);
+                    }
+                }
+                else {
+                    // buffer the right run and merge backwards
+                    T* buf_end = std::uninitialized_move(mid, last, buf);
+                    T* buf_begin = buf;
+                    T* right = buf_end;
+                    T* out = last;
+                    T* left = mid;
+                    merge_guard<T> guard{ buf_begin, right, out, true, buf, buf_end };
+                    while (left != first && right != buf) {
+                        if (comp(*(right - 1), *(left - 1))) *--out = std::move(*--left);
+                        else *--out = std::move(*--right);
+                    }
+                }
+                return;
+            }
+
+            // one element on each side, known to be out of order
+            if (left_size == 1 && right_size == 1) {
+                std::swap(*first, *mid);
+                return;
+            }
+            T* left_cut;
+            T* right_cut;
+            if (left_size > right_size) {
+                left_cut = first + left_size / 2;
+                right_cut = std::lower_bound(mid, last, *left_cut, comp);
+            }
+            else {
+                right_cut = mid + right_size / 2;
+                left_cut = std::upper_bound(first, mid, *right_cut, comp);
+            }
+            T* new_mid = std::rotate(left_cut, mid, right_cut);
+            merge_adjacent(first, left_cut, new_mid, comp, buffer);
+            merge_adjacent(new_mid, right_cut, last, comp, buffer);
+        }
+
+    }
+
+    /// Sort that adapts to existing order. Natural ascending runs are found in
+    /// one pass (strictly descending ones are reversed); if runs of at least
+    /// adaptive_min_run elements cover half of the input, the stretches between
+    /// them are quicksorted and all runs are merged in powersort order with a
+    /// buffer of up to n / 2 elements. Otherwise the range goes to qs::sort.
+    /// Presorted and reversed input take n - 1 comparisons, sorted data with a
+    /// few appended updates is sorted in O(n + k log k).
+    template<typename T, typename Compare>
+    void adaptive_sort(T* first, T* last, Compare comp) {
+        const std::ptrdiff_t n = last - first;
+        if (n <= adaptive_min_run) {
+            sort(first, last, comp, true);
+            return;
+        }
+
+        struct run {
+            T* first;
+            T* last;
+            bool sorted;
+        };
+        std::vector<run> runs;
+        std::ptrdiff_t unsorted = 0;
+        T* gap = first;
+        for (T* it = first; it != last; ) {
+            T* end = detail::find_run(it, last, comp);
+            if (end - it >= adaptive_min_run) {
+                if (gap != it) runs.push_back({ gap, it, false });
+                runs.push_back({ it, end, true });
+                gap = end;
+            }
+            else if ((unsorted += end - it) > n / 2) {
+                // mostly short runs, nothing to gain from merging
+                sort(first, last, comp, true);
+                return;
+            }
+            it = end;
+        }
+        if (gap != last) runs.push_back({ gap, last, false });
+
+        struct pending {
+            T* first;
+            T* last;
+            unsigned power;
+        };
+        std::vector<pending> stack;
+        scratch_buffer<T> buffer;
+        auto merge_top = [&]() {
+            pending& left = stack[stack.size() - 2];
+            detail::merge_adjacent(left.first, left.last, stack.back().last, comp, &buffer);
+            left.last = stack.back().last;
+            stack.pop_back();
+        };
+        for (const run& r : runs) {
+            if (!r.sorted) sort(r.first, r.last, comp, true);
+            if (!stack.empty()) {
+                const pending& top = stack.back();
+                const unsigned power = detail::run_power(top.first - first, top.last - top.first, r.last - r.first, n);
+                while (stack.size() > 1 && stack[stack.size() - 2].power > power) merge_top();
+                stack.back().power = power;
+            }
+            stack.push_back({ r.first, r.last, 0 });
+        }
+        while (stack.size() > 1) merge_top();
+    }
+
+    /// stable_sort insertion sorts chunks of this size before merging them.
+    constexpr std::ptrdiff_t stable_chunk_size = 16;
+
+    namespace detail {
+
+        /// Bottom-up merge sort: insertion sorted chunks, then rounds of merges of
+        /// neighbouring runs of doubling width.
+        template<typename T, typename Compare>
+        void stable_sort_loop(T* first, T* last, Compare comp, scratch_buffer<T>* buffer) {
+            const std::ptrdiff_t n = last - first;
+            for (std::ptrdiff_t i = 0; i < n; i += stable_chunk_size) {
+                insertion_sort(first + i, first + std::min(i + stable_chunk_size, n), comp);
+            }
+            for (std::ptrdiff_t width = stable_chunk_size; width < n; width *= 2) {
+                for (std::ptrdiff_t i = 0; i + width < n; i += 2 * width) {
+                    merge_adjacent(first + i, first + i + width, first + std::min(i + 2 * width, n), comp, buffer);
+                }
+            }
+        }
+
+    }
+
+    /// Stable merge sort through a caller-owned scratch_buffer. The buffer is
+    /// grown once to n / 2 elements if it can grow; reusing it for later calls
+    /// of the same or smaller size does no allocation at all. Merges that do
+    /// not fit a fixed buffer are done in place. O(n log n) with a full buffer.
+    template<typename T, typename Compare>
+    void stable_sort(T* first, T* last, Compare comp, scratch_buffer<T>& buffer) {
+        buffer.reserve((last - first) / 2);
+        detail::stable_sort_loop(first, last, comp, &buffer);
+    }
+
+    /// Stable merge sort without extra memory: every merge is done in place by
+    /// rotations, O(n log^2 n) comparisons and moves. Never allocates.
+    template<typename T, typename Compare>
+    void stable_sort(T* first, T* last, Compare comp) {
+        detail::stable_sort_loop(first, last, comp, static_cast<scratch_buffer<T>*>(nullptr));
+    }
+
+    namespace detail {
+
+        /// Task deque of one worker. The owner pushes and pops at the back,
+        /// idle workers steal the oldest (largest) task from the front.
+        template<typename Task>
+        class work_stealing_queue {
+        public:
+            void push(const Task& task) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_tasks.push_back(task);
+            }
+
+            bool pop(Task& task) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_tasks.empty()) return false;
+                task = m_tasks.back();
+                m_tasks.pop_back();
+                return true;
+            }
+
+            bool steal(Task& task) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_tasks.empty()) return false;
+                task = m_tasks.front();
+                m_tasks.pop_front();
+                return true;
+            }
+
+        private:
+            std::mutex m_mutex;
+            std::deque<Task> m_tasks;
+        };
+
+        /// The first exception thrown on any of a group of threads, for the thread
+        /// that joins them to rethrow.
+        class first_exception {
+        public:
+            /// Call from a catch block.
+            void capture() {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_error) m_error = std::current_exception();
+                m_failed.store(true, std::memory_order_relaxed);
+            }
+
+            bool failed() const {
+                return m_failed.load(std::memory_order_relaxed);
+            }
+
+            void rethrow() const {
+                if (m_error) std::rethrow_exception(m_error);
+            }
+
+        private:
+            std::mutex m_mutex;
+            std::exception_ptr m_error;
+            std::atomic<bool> m_failed{ false };
+        };
+
+        /// Fixed group of workers executing one job. A task may spawn more tasks
+        /// on its own worker, run() returns once every task has finished.
+        /// The calling thread takes part as worker 0, idle workers sleep until
+        /// a task is spawned. If a task throws, the tasks not started yet are
+        /// dropped and run() rethrows the first exception.
+        template<typename Task>
+        class work_stealing_pool {
+        public:
+            explicit work_stealing_pool(unsigned threads) : m_queues(threads) {}
+
+            template<typename Body>
+            void run(const std::vector<Task>& roots, Body body) {
+                if (roots.empty()) return;
+                m_pending.store(roots.size());
+                // deal initial tasks round-robin so every worker starts busy
+                for (std::size_t i = 0; i < roots.size(); ++i) {
+                    m_queues[i % m_queues.size()].push(roots[i]);
+                }
+
+                std::vector<std::thread> workers;
+                workers.reserve(m_queues.size() - 1);
+                for (unsigned id = 1; id < m_queues.size(); ++id) {
+                    workers.emplace_back([this, &body, id] { work(id, body); });
+                }
+                work(0, body);
+                for (std::thread& worker : workers) worker.join();
+                m_error.rethrow();
+            }
+
+            /// Queue a new task on worker id. Only valid from inside a running task.
+            void spawn(unsigned id, const Task& task) {
+                // count it before it becomes visible, so pending never hits zero early
+                m_pending.fetch_add(1, std::memory_order_relaxed);
+                m_queues[id].push(task);
+                wake(false);
+            }
+
+        private:
+            std::vector<work_stealing_queue<Task>> m_queues;
+            std::atomic<std::size_t> m_pending{ 0 };
+            // bumped on every spawn and when the last task finishes, idle workers wait on it
+            std::atomic<std::uint32_t> m_signal{ 0 };
+            first_exception m_error;
+
+            void wake(bool all) {
+                m_signal.fetch_add(1, std::memory_order_release);
+                if (all) m_signal.notify_all();
+                else m_signal.notify_one();
+            }
+
+            template<typename Body>
+            void work(unsigned id, Body& body) {
+                Task task;
+                for (;;) {
+                    // read before looking for work, so a task spawned after a
+                    // fruitless look still ends the wait below
+                    const std::uint32_t seen = m_signal.load(std::memory_order_acquire);
+                    if (m_queues[id].pop(task) || steal(id, task)) {
+                        if (!m_error.failed()) {
+                            try {
+                                body(id, task);
+                            }
+                            catch (...) {
+                                m_error.capture();
+                            }
+                        }
+                        if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) wake(true);
+                    }
+                    else if (m_pending.load(std::memory_order_acquire) == 0) {
+                        return;
+                    }
+                    else {
+                        m_signal.wait(seen, std::memory_order_acquire);
+                    }
+                }
+            }
+
+            bool steal(unsigned id, Task& task) {
+                const std::size_t n = m_queues.size();
+                for (std::size_t k = 1; k < n; ++k) {
+                    if (m_queues[(id + k) % n].steal(task)) return true;
+                }
+                return false;
+            }
+        };
+
+        /// Run f(0) .. f(threads - 1) concurrently, f(0) on the calling thread.
+        /// Rethrows the first exception once every call has returned.
+        template<typename F>
+        void parallel_for(unsigned threads, F f) {
+            first_exception error;
+            std::vector<std::thread> workers;
+            workers.reserve(threads - 1);
+            for (unsigned i = 1; i < threads; ++i) {
+                workers.emplace_back([&error, f, i]() mutable {
+                    try {
+                        f(i);
+                    }
+                    catch (...) {
+                        error.capture();
+                    }
+                });
+            }
+            try {
+                f(0u);
+            }
+            catch (...) {
+                error.capture();
+            }
+            for (std::thread& worker : workers) worker.join();
+            error.rethrow();
+        }
+
+        /// Partition of [first, last), pivot at last-1, done by `threads` threads.
+        /// Every thread runs a Hoare scan on its own block, then the elements that
+        /// ended up on the wrong side of the global split are swapped across in
+        /// parallel.
+        template<typename T, typename Compare>
+        T* parallel_partition_selected(T* first, T* last, Compare comp, unsigned threads) {
+            T* end = last - 1;
+            const std::size_t n = end - first;
+
+            std::vector<T*> bounds(threads + 1);
+            for (unsigned i = 0; i <= threads; ++i) bounds[i] = first + n * i / threads;
+
+            std::vector<T*> splits(threads);
+            parallel_for(threads, [&](unsigned i) {
+                splits[i] = partition_around(bounds[i], bounds[i + 1], *(last - 1), comp);
+            });
+
+            std::size_t left_count = 0;
+            for (unsigned i = 0; i < threads; ++i) left_count += splits[i] - bounds[i];
+            T* split = first + left_count;
+
+            // blocks of ">= pivot" left of split and "<= pivot" right of split,
+            // both lists hold the same number of elements in total
+            struct block { T* ptr; std::size_t len; std::size_t offset; };
+            std::vector<block> wrong_left;
+            std::vector<block> wrong_right;
+            std::size_t misplaced = 0;
+            std::size_t right_total = 0;
+            for (unsigned i = 0; i < threads; ++i) {
+                if (splits[i] < split) {
+                    T* stop = std::min(bounds[i + 1], split);
+                    wrong_left.push_back({ splits[i], static_cast<std::size_t>(stop - splits[i]), misplaced });
+                    misplaced += stop - splits[i];
+                }
+                if (splits[i] > split) {
+                    T* start = std::max(bounds[i], split);
+                    wrong_right.push_back({ start, static_cast<std::size_t>(splits[i] - start), right_total });
+                    right_total += splits[i] - start;
+                }
+            }
+            assert(misplaced == right_total);
+
+            auto locate = [](const std::vector<block>& blocks, std::size_t k) {
+                auto it = std::upper_bound(blocks.begin(), blocks.end(), k,
+                    [](std::size_t value, const block& b) { return value < b.offset; });
+                return static_cast<std::size_t>(it - blocks.begin()) - 1;
+            };
+
+            parallel_for(threads, [&](unsigned i) {
+                std::size_t k = misplaced * i / threads;
+                const std::size_t stop = misplaced * (i + 1) / threads;
+                if (k == stop) return;
+                std::size_t a = locate(wrong_left, k);
+                std::size_t b = locate(wrong_right, k);
+                std::size_t a_pos = k - wrong_left[a].offset;
+                std::size_t b_pos = k - wrong_right[b].offset;
+                for (; k < stop; ++k) {
+                    std::swap(wrong_left[a].ptr[a_pos], wrong_right[b].ptr[b_pos]);
+                    if (++a_pos == wrong_left[a].len) { ++a; a_pos = 0; }
+                    if (++b_pos == wrong_right[b].len) { ++b; b_pos = 0; }
+                }
+            });
+
+            std::swap(*split, *(last - 1));
+            return split;
+        }
+
+        /// Range of parallel_sort and the number of threads it may still use.
+        /// Unless leftmost, *(first - 1) is not greater than any of its elements.
+        template<typename T>
+        struct parallel_task {
+            T* first;
+            T* last;
+            unsigned threads;
+            bool leftmost;
+        };
+
+        /// One parallel partition of a task with threads of its own. The halves
+        /// are spawned on the pool, each with a share of the threads in proportion
+        /// to its size.
+        template<typename T, typename Compare, typename Pool>
+        void parallel_split(const parallel_task<T>& task, Compare comp, Pool& pool, unsigned id) {
+            T* first = task.first;
+            T* last = task.last;
+            select_pivot(first, last, comp);
+
+            // the partitions send keys equal to the pivot right, so a pivot equal
+            // to the lower bound would leave the left side empty: drop the run of
+            // equal keys in one three-way pass instead, as sort_loop does
+            if (!task.leftmost && !comp(*(first - 1), *(last - 1))) {
+                T* greater = partition_three_way_selected(first, last, comp).second;
+                if (greater != last) pool.spawn(id, { greater, last, task.threads, false });
+                return;
+            }
+
+            T* pivot = parallel_partition_selected(first, last, comp, task.threads);
+            // a lopsided split would hand nearly all threads another full pass
+            // over nearly the same range; the sequential tasks finish it instead
+            if (break_bad_partition(first, pivot, last)) {
+                if (first != pivot) pool.spawn(id, { first, pivot, 1, task.leftmost });
+                if (pivot + 1 != last) pool.spawn(id, { pivot + 1, last, 1, false });
+                return;
+            }
+
+            const double share = static_cast<double>(pivot - first) / (last - first);
+            unsigned left_threads = static_cast<unsigned>(share * task.threads + 0.5);
+            left_threads = std::clamp(left_threads, 1u, task.threads - 1);
+            pool.spawn(id, { first, pivot, left_threads, task.leftmost });
+            pool.spawn(id, { pivot + 1, last, task.threads - left_threads, false });
+        }
+
+    }
+
+    /// Parallel quicksort on a work-stealing pool. Large ranges are split by
+    /// parallel partitions, each half getting a share of the threads, until a
+    /// range is left to one thread; such tasks are split further by sequential
+    /// partitions down to the tuned parallel_cutoff, sharing the larger half
+    /// with idle workers, and finished with the sequential sort. threads == 0
+    /// uses all hardware threads.
+    /// If comp throws, the first exception is rethrown once every thread has
+    /// stopped; the range then holds some permutation of its elements.
+    template<typename T, typename Compare>
+    void parallel_sort(T* first, T* last, Compare comp, unsigned threads = 0) {
+        const std::ptrdiff_t cutoff = tuning_for<T>().parallel_cutoff;
+        // small ranges first, hardware_concurrency() can cost microseconds
+        if (last - first <= cutoff) {
+            sort(first, last, comp, true);
+            return;
+        }
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        if (threads == 1) {
+            sort(first, last, comp, true);
+            return;
+        }
+
+        using Task = detail::parallel_task<T>;
+        detail::work_stealing_pool<Task> pool(threads);
+        pool.run({ Task{ first, last, threads, true } }, [&](unsigned id, Task task) {
+            if (task.threads > 1 && task.last - task.first > cutoff * static_cast<std::ptrdiff_t>(task.threads)) {
+                detail::parallel_split(task, comp, pool, id);
+                return;
+            }
+            while (task.last - task.first > cutoff) {
+                select_pivot(task.first, task.last, comp);
+                // run of keys equal to the lower bound, see parallel_split
+                if (!task.leftmost && !comp(*(task.first - 1), *(task.last - 1))) {
+                    task.first = detail::partition_three_way_selected(task.first, task.last, comp).second;
+                    continue;
+                }
+                T* pivot = detail::partition_selected(task.first, task.last, comp);
+                // lopsided split, let the sequential introsort guard this range
+                if (detail::break_bad_partition(task.first, pivot, task.last)) break;
+
+                Task left{ task.first, pivot, 1, task.leftmost };
+                Task right{ pivot + 1, task.last, 1, false };
+                // keep working on the smaller half, share the larger one
+                if (left.last - left.first < right.last - right.first) std::swap(left, right);
+                pool.spawn(id, left);
+                task = right;
+            }
+            sort(task.first, task.last, comp, true);
+        });
+    }
+
+    namespace detail {
+
+        /// Key of one element together with the element's position.
+        template<typename Key>
+        struct keyed_index {
+            Key key;
+            std::size_t index;
+        };
+
+        /// Rearrange [first, first + n) so that position i receives the element
+        /// that was at source[i]. Follows the cycles of the permutation, so every
+        /// element is moved exactly once (plus once into a temporary per cycle).
+        /// source is used as scratch: it holds the identity on return.
+        template<typename T, typename Index>
+        void permute_cycles(T* first, Index* source, std::size_t n) {
+            for (std::size_t start = 0; start < n; ++start) {
+                if (static_cast<std::size_t>(source[start]) == start) continue;
+                T tmp = std::move(first[start]);
+                std::size_t hole = start;
+                for (std::size_t next = source[hole]; next != start; next = source[hole]) {
+                    first[hole] = std::move(first[next]);
+                    source[hole] = static_cast<Index>(hole);
+                    hole = next;
+                }
+                first[hole] = std::move(tmp);
+                source[hole] = static_cast<Index>(hole);
+            }
+        }
+
+    }
+
+    /// Sort by key_fn(element), calling key_fn exactly once per element. The keys
+    /// are cached in a (key, index) array which is sorted instead of the elements,
+    /// the elements are then moved into place by following the permutation.
+    /// Narrow radix sortable keys in std::less order are packed with their index
+    /// into one 64-bit word, which also keeps equal keys in input order (signed
+    /// zeros included).
+    template<typename T, typename KeyFn, typename Compare = std::less<>>
+    void sort_by_key(T* first, T* last, KeyFn key_fn, Compare comp = Compare()) {
+        using Key = std::decay_t<std::invoke_result_t<KeyFn&, const T&>>;
+        const std::size_t n = last - first;
+        if (n < 2) return;
+
+        if constexpr (is_radix_sortable<Key>::value && sizeof(Key) <= 4 &&
+            (std::is_same_v<Compare, std::less<Key>> || std::is_same_v<Compare, std::less<>>)) {
+            if (n <= std::numeric_limits<std::uint32_t>::max()) {
+                std::unique_ptr<std::uint64_t[]> packed(new std::uint64_t[n]);
+                for (std::size_t i = 0; i < n; ++i) {
+                    Key key = key_fn(std::as_const(first[i]));
+                    // -0.0 == +0.0, but their bits differ and would reorder them
+                    if constexpr (std::is_floating_point_v<Key>) {
+                        if (key == Key(0)) key = Key(0);
+                    }
+                    packed[i] = std::uint64_t(detail::radix_key(key)) << 32 | i;
+                }
+                sort(packed.get(), packed.get() + n, std::less<std::uint64_t>(), true);
+                std::unique_ptr<std::uint32_t[]> source(new std::uint32_t[n]);
+                for (std::size_t i = 0; i < n; ++i) source[i] = static_cast<std::uint32_t>(packed[i]);
+                packed.reset();
+                detail::permute_cycles(first, source.get(), n);
+                return;
+            }
+        }
+
+        std::vector<detail::keyed_index<Key>> keys;
+        keys.reserve(n);
+        for (std::size_t i = 0; i < n; ++i) keys.push_back({ key_fn(std::as_const(first[i])), i });
+        sort(keys.data(), keys.data() + n, [&comp](const detail::keyed_index<Key>& a, const detail::keyed_index<Key>& b) {
+            return comp(a.key, b.key);
+        }, true);
+
+        std::unique_ptr<std::size_t[]> source(new std::size_t[n]);
+        for (std::size_t i = 0; i < n; ++i) source[i] = keys[i].index;
+        keys = {};
+        detail::permute_cycles(first, source.get(), n);
+    }
+
+    /// Indices of [first, last) in sorted order: element first[result[i]] belongs
+    /// at position i. Only indices are moved while sorting, the elements stay put.
+    /// Equal elements may appear in any order.
+    template<typename T, typename Compare>
+    std::vector<std::size_t> argsort(const T* first, const T* last, Compare comp) {
+        std::vector<std::size_t> indices(last - first);
+        std::iota(indices.begin(), indices.end(), std::size_t(0));
+        sort(indices.data(), indices.data() + indices.size(), [first, &comp](std::size_t a, std::size_t b) {
+            return comp(first[a], first[b]);
+        }, true);
+        return indices;
+    }
+
+    /// Reorder [first, last) so that position i receives the element that was at
+    /// permutation[i] (the layout returned by argsort). Every element is moved
+    /// exactly once by following the cycles of the permutation. Throws
+    /// std::invalid_argument, leaving the range untouched, if permutation is not
+    /// a permutation of 0 .. last - first - 1.
+    template<typename T, typename Index>
+    void apply_permutation(T* first, T* last, const Index* permutation) {
+        const std::size_t n = last - first;
+        std::vector<bool> done(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            const std::size_t source = static_cast<std::size_t>(permutation[i]);
+            if (source >= n || done[source]) throw std::invalid_argument("apply_permutation: not a permutation");
+            done[source] = true;
+        }
+
+        // done flips back to false for every position that has been filled
+        for (std::size_t start = 0; start < n; ++start) {
+            if (!done[start]) continue;
+            done[start] = false;
+            if (static_cast<std::size_t>(permutation[start]) == start) continue;
+            T tmp = std::move(first[start]);
+            std::size_t hole = start;
+            for (std::size_t next = permutation[hole]; next != start; next = permutation[hole]) {
+                first[hole] = std::move(first[next]);
+                done[next] = false;
+                hole = next;
+            }
+            first[hole] = std::move(tmp);
+        }
+    }
+
+    /// segmented_sort finishes segments up to this size with the bare quicksort
+    /// loop, bigger ones take the full qs::sort with radix dispatch.
+    constexpr std::ptrdiff_t segment_medium_limit = 512;
+
+    /// Sort every segment [data + offsets[i], data + offsets[i + 1]) of a flat
+    /// buffer in one call; offsets_end - offsets is the number of segments plus
+    /// one. Segments are grouped by size class (sorting networks up to
+    /// max_network_size, the quicksort loop up to segment_medium_limit, qs::sort
+    /// above) so each kernel runs over a whole group. Above the parallel cutoff,
+    /// segments bigger than a thread's share get parallel_sort and the rest are
+    /// dealt out in batches of similar element count to the work-stealing pool.
+    /// threads == 0 uses all hardware threads. Throws std::invalid_argument if
+    /// the offsets decrease.
+    template<typename T, typename Offset, typename Compare>
+    void segmented_sort(T* data, const Offset* offsets, const Offset* offsets_end, Compare comp, unsigned threads = 0) {
+        if (offsets_end - offsets < 2) return;
+        const std::size_t segments = offsets_end - offsets - 1;
+        auto size_class = [](std::ptrdiff_t size) {
+            return size <= max_network_size ? 0 : size <= segment_medium_limit ? 1 : 2;
+        };
+
+        // counting sort of the segment indices by class, input order within a class
+        std::size_t starts[4] = {};
+        for (std::size_t s = 0; s < segments; ++s) {
+            if (offsets[s + 1] < offsets[s]) throw std::invalid_argument("segmented_sort: offsets must not decrease");
+            ++starts[size_class(static_cast<std::ptrdiff_t>(offsets[s + 1] - offsets[s])) + 1];
+        }
+        for (int c = 1; c < 4; ++c) starts[c] += starts[c - 1];
+        std::vector<std::size_t> order(segments);
+        for (std::size_t s = 0; s < segments; ++s) {
+            order[starts[size_class(static_cast<std::ptrdiff_t>(offsets[s + 1] - offsets[s]))]++] = s;
+        }
+
+        const std::ptrdiff_t small_size = detail::small_sort_size<T>();
+        auto sort_segment = [&](std::size_t s) {
+            T* first = data + offsets[s];
+            T* last = data + offsets[s + 1];
+            if (last - first <= max_network_size) {
+                small_sort(first, last, comp);
+            }
+            else if (last - first <= segment_medium_limit) {
+                detail::sort_loop(first, last, comp, true, small_size, detail::bad_partition_budget(last - first), true);
+            }
+            else {
+                sort(first, last, comp, true);
+            }
+        };
+
+        const std::ptrdiff_t total = static_cast<std::ptrdiff_t>(offsets[segments] - offsets[0]);
+        if (total > tuning_for<T>().parallel_cutoff) {
+            if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        else {
+            threads = 1;
+        }
+        if (threads == 1) {
+            for (std::size_t s : order) sort_segment(s);
+            return;
+        }
+
+        // a segment above one thread's share would leave the others idle
+        const std::ptrdiff_t share = total / threads;
+        // after the fill, starts[1] is where the large class begins
+        const std::size_t end = std::partition(order.begin() + starts[1], order.end(), [&](std::size_t s) {
+            return static_cast<std::ptrdiff_t>(offsets[s + 1] - offsets[s]) <= share;
+        }) - order.begin();
+        for (std::size_t i = end; i < segments; ++i) {
+            parallel_sort(data + offsets[order[i]], data + offsets[order[i] + 1], comp, threads);
+        }
+
+        // batches of about a quarter share, enough for stealing to even out the load
+        using Batch = std::pair<std::size_t, std::size_t>;
+        std::vector<Batch> batches;
+        const std::ptrdiff_t batch_elements = std::max<std::ptrdiff_t>(1, share / 4);
+        std::ptrdiff_t filled = 0;
+        std::size_t batch_begin = 0;
+        for (std::size_t i = 0; i < end; ++i) {
+            filled += static_cast<std::ptrdiff_t>(offsets[order[i] + 1] - offsets[order[i]]) + 1;
+            if (filled >= batch_elements) {
+                batches.emplace_back(batch_begin, i + 1);
+                batch_begin = i + 1;
+                filled = 0;
+            }
+        }
+        if (batch_begin != end) batches.emplace_back(batch_begin, end);
+
+        detail::work_stealing_pool<Batch> pool(threads);
+        pool.run(batches, [&](unsigned, Batch batch) {
+            for (std::size_t i = batch.first; i < batch.second; ++i) sort_segment(order[i]);
+        });
+    }
+
+    /// Tournament tree of losers over k sorted sources, identified by index.
+    /// Every source has a current head, nullptr once it is exhausted; top() is
+    /// the source with the smallest head, ties going to the lower index. After
+    /// the caller consumes that head, replace_top replays a single leaf-to-root
+    /// path, one comparison per level, so about log2(k) per element against
+    /// 2 log2(k) for a binary heap. Head pointers must stay valid until replaced.
+    template<typename T, typename Compare = std::less<T>>
+    class loser_tree {
+    public:
+        explicit loser_tree(std::vector<const T*> heads, Compare comp = Compare())
+            : m_heads(std::move(heads)), m_tree(std::max<std::size_t>(1, m_heads.size())), m_comp(comp) {
+            const std::size_t k = m_heads.size();
+            if (k < 2) return;
+            // winners of the subtrees, internal nodes 1..k-1, leaf i at node k + i
+            std::vector<std::size_t> winners(2 * k);
+            for (std::size_t i = 0; i < k; ++i) winners[k + i] = i;
+            for (std::size_t node = k - 1; node >= 1; --node) {
+                std::size_t a = winners[2 * node];
+                std::size_t b = winners[2 * node + 1];
+                if (beats(b, a)) std::swap(a, b);
+                winners[node] = a;
+                m_tree[node] = b;
+            }
+            m_tree[0] = winners[1];
+        }
+
+        bool empty() const { return m_heads.empty() || !m_heads[m_tree[0]]; }
+        std::size_t top() const { return m_tree[0]; }
+        const T& top_value() const { return *m_heads[m_tree[0]]; }
+
+        /// Give the winning source its next head, nullptr when it has none.
+        void replace_top(const T* head) {
+            std::size_t winner = m_tree[0];
+            m_heads[winner] = head;
+            for (std::size_t node = (winner + m_heads.size()) / 2; node >= 1; node /= 2) {
+                if (beats(m_tree[node], winner)) std::swap(m_tree[node], winner);
+            }
+            m_tree[0] = winner;
+        }
+
+    private:
+        std::vector<const T*> m_heads;
+        // m_tree[0] is the overall winner, m_tree[node] the loser of that match
+        std::vector<std::size_t> m_tree;
+        Compare m_comp;
+
+        // strict total order on (head, index) with exhausted sources last
+        bool beats(std::size_t a, std::size_t b) const {
+            if (!m_heads[a] || !m_heads[b]) return m_heads[a] ? true : m_heads[b] ? false : a < b;
+            return a < b ? !m_comp(*m_heads[b], *m_heads[a]) : m_comp(*m_heads[a], *m_heads[b]);
+        }
+    };
+
+    /// A sorted input [first, second) of kway_merge.
+    template<typename T>
+    using sorted_run = std::pair<const T*, const T*>;
+
+    /// Merge k sorted runs into out, which must not overlap them, through a
+    /// loser_tree. Stable: equal elements keep the order of their runs.
+    /// Returns the end of the output.
+    template<typename T, typename Compare>
+    T* kway_merge(const std::vector<sorted_run<T>>& runs, T* out, Compare comp) {
+        if (runs.size() == 1) return std::copy(runs[0].first, runs[0].second, out);
+        if (runs.size() == 2) return std::merge(runs[0].first, runs[0].second, runs[1].first, runs[1].second, out, comp);
+
+        std::vector<const T*> heads(runs.size());
+        for (std::size_t i = 0; i < runs.size(); ++i) {
+            heads[i] = runs[i].first != runs[i].second ? runs[i].first : nullptr;
+        }
+        loser_tree<T, Compare> tree(std::move(heads), comp);
+        while (!tree.empty()) {
+            const std::size_t i = tree.top();
+            const T* head = &tree.top_value();
+            *out++ = *head;
+            tree.replace_top(++head != runs[i].second ? head : nullptr);
+        }
+        return out;
+    }
+
+    /// Merge path for k runs: how many elements of each run come before output
+    /// position rank in their stable merge. Pieces between two splits merge
+    /// independently. Pivots are taken from the middle of the widest remaining
+    /// window and their rank narrows every window, so the search needs
+    /// O(k log n) comparisons per pivot and usually few pivots.
+    template<typename T, typename Compare>
+    std::vector<std::size_t> merge_path(const std::vector<sorted_run<T>>& runs, std::size_t rank, Compare comp) {
+        const std::size_t k = runs.size();
+        std::vector<std::size_t> lo(k, 0), hi(k), counts(k);
+        for (std::size_t i = 0; i < k; ++i) hi[i] = runs[i].second - runs[i].first;
+
+        for (;;) {
+            std::size_t widest = k;
+            for (std::size_t i = 0; i < k; ++i) {
+                if (hi[i] > lo[i] && (widest == k || hi[i] - lo[i] > hi[widest] - lo[widest])) widest = i;
+            }
+            if (widest == k) return lo;
+
+            // rank of the pivot: elements of earlier runs equal to it come first
+            const std::size_t position = lo[widest] + (hi[widest] - lo[widest]) / 2;
+            const T& pivot = runs[widest].first[position];
+            std::size_t before = 0;
+            for (std::size_t i = 0; i < k; ++i) {
+                const T* first = runs[i].first;
+                if (i == widest) counts[i] = position;
+                else if (i < widest) counts[i] = std::upper_bound(first + lo[i], first + hi[i], pivot, comp) - first;
+                else counts[i] = std::lower_bound(first + lo[i], first + hi[i], pivot, comp) - first;
+                before += counts[i];
+            }
+
+            if (before < rank) {
+                for (std::size_t i = 0; i < k; ++i) lo[i] = counts[i];
+                lo[widest] = position + 1;
+            }
+            else {
+                for (std::size_t i = 0; i < k; ++i) hi[i] = counts[i];
+            }
+        }
+    }
+
+    /// kway_merge split by merge_path into pieces of equal output length, which
+    /// the threads merge straight into their part of out. threads == 0 uses all
+    /// hardware threads.
+    template<typename T, typename Compare>
+    T* parallel_kway_merge(const std::vector<sorted_run<T>>& runs, T* out, Compare comp, unsigned threads = 0) {
+        std::size_t total = 0;
+        for (const sorted_run<T>& run : runs) total += run.second - run.first;
+        if (static_cast<std::ptrdiff_t>(total) > tuning_for<T>().parallel_cutoff) {
+            if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        else {
+            threads = 1;
+        }
+        if (threads == 1) return kway_merge(runs, out, comp);
+
+        std::vector<std::vector<std::size_t>> splits(threads + 1);
+        detail::parallel_for(threads + 1, [&](unsigned t) {
+            splits[t] = merge_path(runs, total * t / threads, comp);
+        });
+        detail::parallel_for(threads, [&](unsigned t) {
+            std::vector<sorted_run<T>> pieces(runs.size());
+            for (std::size_t i = 0; i < runs.size(); ++i) {
+                pieces[i] = { runs[i].first + splits[t][i], runs[i].first + splits[t + 1][i] };
+            }
+            kway_merge(pieces, out + total * t / threads, comp);
+        });
+        return out + total;
+    }
+
+    /// Settings for external_sort.
+    struct external_sort_options {
+        // bytes of record buffers in use at any time, sets the length of the runs
+        std::size_t memory_budget = std::size_t(256) << 20;
+        // bytes moved by one read or write call during the merge, reduced to a
+        // sixth of memory_budget so that at least two runs merge at a time
+        std::size_t io_block_size = std::size_t(1) << 20;
+        // where runs are spilled, the system temp directory when empty
+        std::filesystem::path temp_directory;
+    };
+
+    namespace detail {
+
+        struct file_closer {
+            void operator()(std::FILE* file) const { std::fclose(file); }
+        };
+
+        using file_ptr = std::unique_ptr<std::FILE, file_closer>;
+
+        inline file_ptr open_file(const std::filesystem::path& path, const char* mode) {
+            file_ptr file(std::fopen(path.string().c_str(), mode));
+            if (!file) throw std::runtime_error("external_sort: cannot open " + path.string());
+            // all transfers are large blocks already, skip the stdio buffer
+            std::setvbuf(file.get(), nullptr, _IONBF, 0);
+            return file;
+        }
+
+        /// Read up to count records, returns how many were read (0 at end of file).
+        template<typename T>
+        std::size_t read_records(std::FILE* file, T* data, std::size_t count) {
+            const std::size_t read = std::fread(data, sizeof(T), count, file);
+            if (read < count && std::ferror(file)) throw std::runtime_error("external_sort: read failed");
+            return read;
+        }
+
+        template<typename T>
+        void write_records(std::FILE* file, const T* data, std::size_t count) {
+            if (std::fwrite(data, sizeof(T), count, file) != count) throw std::runtime_error("external_sort: write failed");
+        }
+
+        /// Spilled runs, removed from disk when they are no longer needed.
+        class temp_runs {
+        public:
+            explicit temp_runs(std::filesystem::path directory) : m_directory(std::move(directory)) {
+                std::random_device seed;
+                m_prefix = "qs_run_" + std::to_string(seed()) + "_";
+            }
+
+            ~temp_runs() {
+                std::error_code ignored;
+                for (const std::filesystem::path& run : m_runs) std::filesystem::remove(run, ignored);
+            }
+
+            temp_runs(const temp_runs&) = delete;
+            temp_runs& operator=(const temp_runs&) = delete;
+
+            const std::filesystem::path& create() {
+                m_runs.push_back(m_directory / (m_prefix + std::to_string(m_counter++) + ".tmp"));
+                return m_runs.back();
+            }
+
+            /// Delete runs [first, last) and forget about them.
+            void remove(std::size_t first, std::size_t last) {
+                std::error_code ignored;
+                for (std::size_t i = first; i < last; ++i) std::filesystem::remove(m_runs[i], ignored);
+                m_runs.erase(m_runs.begin() + first, m_runs.begin() + last);
+            }
+
+            std::size_t size() const { return m_runs.size(); }
+            const std::filesystem::path& operator[](std::size_t i) const { return m_runs[i]; }
+
+        private:
+            std::filesystem::path m_directory;
+            std::string m_prefix;
+            std::size_t m_counter = 0;
+            std::vector<std::filesystem::path> m_runs;
+        };
+
+        /// Sequential reader of one sorted run. While the current block is merged,
+        /// the next one is already being read in the background.
+        template<typename T>
+        class run_reader {
+        public:
+            run_reader(const std::filesystem::path& path, std::size_t block_records)
+                : m_file(open_file(path, "rb")), m_current(block_records), m_next(block_records) {
+                prefetch();
+                next_block();
+            }
+
+            bool empty() const { return m_pos == m_count; }
+            const T& front() const { return m_current[m_pos]; }
+
+            void pop() {
+                if (++m_pos == m_count) next_block();
+            }
+
+        private:
+            file_ptr m_file;
+            std::vector<T> m_current;
+            std::vector<T> m_next;
+            std::size_t m_pos = 0;
+            std::size_t m_count = 0;
+            // declared last, so its destructor waits for the read before the buffers go
+            std::future<std::size_t> m_pending;
+
+            void prefetch() {
+                std::FILE* file = m_file.get();
+                T* data = m_next.data();
+                const std::size_t count = m_next.size();
+                m_pending = std::async(std::launch::async, [file, data, count] { return read_records(file, data, count); });
+            }
+
+            void next_block() {
+                m_count = m_pending.valid() ? m_pending.get() : 0;
+                m_pos = 0;
+                std::swap(m_current, m_next);
+                // a short block means the end of the run was reached
+                if (m_count == m_current.size()) prefetch();
+            }
+        };
+
+        /// Sequential writer. Full blocks are written in the background while the
+        /// next one is being filled.
+        template<typename T>
+        class run_writer {
+        public:
+            run_writer(const std::filesystem::path& path, std::size_t block_records)
+                : m_file(open_file(path, "wb")), m_block_records(block_records) {
+                m_current.reserve(block_records);
+                m_next.reserve(block_records);
+            }
+
+            void push(const T& value) {
+                m_current.push_back(value);
+                if (m_current.size() == m_block_records) flush();
+            }
+
+            void finish() {
+                flush();
+                wait();
+                if (std::fflush(m_file.get()) != 0) throw std::runtime_error("external_sort: write failed");
+                m_file.reset();
+            }
+
+        private:
+            file_ptr m_file;
+            std::size_t m_block_records;
+            std::vector<T> m_current;
+            std::vector<T> m_next;
+            std::future<void> m_pending;
+
+            void wait() {
+                if (m_pending.valid()) m_pending.get();
+            }
+
+            void flush() {
+                wait();
+                std::swap(m_current, m_next);
+                m_current.clear();
+                std::FILE* file = m_file.get();
+                const T* data = m_next.data();
+                const std::size_t count = m_next.size();
+                m_pending = std::async(std::launch::async, [file, data, count] { write_records(file, data, count); });
+            }
+        };
+
+        /// k-way merge of the runs [first, last) into output through a loser_tree
+        /// over the readers' current records.
+        template<typename T, typename Compare>
+        void merge_runs(const temp_runs& runs, std::size_t first, std::size_t last,
+            const std::filesystem::path& output, Compare comp, std::size_t block_records) {
+            std::vector<std::unique_ptr<run_reader<T>>> readers;
+            std::vector<const T*> heads;
+            for (std::size_t i = first; i < last; ++i) {
+                readers.push_back(std::make_unique<run_reader<T>>(runs[i], block_records));
+                heads.push_back(readers.back()->empty() ? nullptr : &readers.back()->front());
+            }
+            loser_tree<T, Compare> tree(std::move(heads), comp);
+
+            run_writer<T> writer(output, block_records);
+            while (!tree.empty()) {
+                run_reader<T>& reader = *readers[tree.top()];
+                writer.push(reader.front());
+                reader.pop();
+                tree.replace_top(reader.empty() ? nullptr : &reader.front());
+            }
+            writer.finish();
+        }
+
+    }
+
+    /// Sort a file of fixed-width records T that may be larger than memory.
+    /// Chunks of memory_budget bytes are read, sorted with qs::sort and spilled
+    /// as runs to temp_directory; the runs are then combined by k-way merges
+    /// with double-buffered background reads. When there are more runs than the
+    /// budget can give an I/O block pair each, they are merged in several passes.
+    /// Throws std::invalid_argument if memory_budget is 0 and std::runtime_error
+    /// on I/O errors.
+    template<typename T, typename Compare>
+    void external_sort(const std::filesystem::path& input, const std::filesystem::path& output,
+        Compare comp, const external_sort_options& options = {}) {
+        static_assert(std::is_trivially_copyable_v<T>, "external_sort works on fixed-width records");
+        if (options.memory_budget == 0) throw std::invalid_argument("external_sort: memory_budget must not be 0");
+
+        const std::uintmax_t bytes = std::filesystem::file_size(input);
+        if (bytes % sizeof(T) != 0) throw std::runtime_error("external_sort: file size is not a multiple of the record size");
+        const std::size_t total = static_cast<std::size_t>(bytes / sizeof(T));
+        const std::size_t run_records = std::max<std::size_t>(1, options.memory_budget / sizeof(T));
+
+        detail::temp_runs runs(options.temp_directory.empty() ? std::filesystem::temp_directory_path() : options.temp_directory);
+        {
+            detail::file_ptr in = detail::open_file(input, "rb");
+            std::vector<T> chunk(std::min(run_records, total));
+            for (std::size_t done = 0; done < total; ) {
+                const std::size_t count = detail::read_records(in.get(), chunk.data(), std::min(chunk.size(), total - done));
+                if (count == 0) throw std::runtime_error("external_sort: input ended early");
+                sort(chunk.data(), chunk.data() + count, comp, true);
+                done += count;
+
+                // everything fit into memory, no merge needed
+                const bool single_run = done == total && runs.size() == 0;
+                detail::file_ptr out = detail::open_file(single_run ? output : runs.create(), "wb");
+                detail::write_records(out.get(), chunk.data(), count);
+                if (std::fflush(out.get()) != 0) throw std::runtime_error("external_sort: write failed");
+                if (single_run) return;
+            }
+        }
+        if (runs.size() == 0) {
+            // empty input
+            detail::open_file(output, "wb");
+            return;
+        }
+
+        // every merged run and the output need two blocks each, blocks shrink
+        // until the budget holds the three pairs of a two-way merge
+        const std::size_t block_bytes = std::max<std::size_t>(sizeof(T), std::min(options.io_block_size, options.memory_budget / 6));
+        const std::size_t fan_in = std::max<std::size_t>(3, options.memory_budget / (2 * block_bytes)) - 1;
+        auto block_records = [&](std::size_t k) {
+            return std::max<std::size_t>(1, options.memory_budget / (2 * (k + 1)) / sizeof(T));
+        };
+
+        while (runs.size() > fan_in) {
+            // merge the oldest runs into a new one at the back
+            const std::filesystem::path merged = runs.create();
+            detail::merge_runs<T>(runs, 0, fan_in, merged, comp, block_records(fan_in));
+            runs.remove(0, fan_in);
         }
+        detail::merge_runs<T>(runs, 0, runs.size(), output, comp, block_records(runs.size()));
     }
 
 }
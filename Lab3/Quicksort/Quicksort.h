@@ -5,12 +5,58 @@
 
 #include <algorithm>
 #include <utility>
+#include <functional>
+#include <type_traits>
 #include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <bit>
 #include <cassert>
 #include <random>
 #include <vector>
+#include <array>
+#include <memory>
+#include <new>
+#include <memory_resource>
+#include <limits>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <filesystem>
+#include <cstdio>
+#include <stdexcept>
+#include <exception>
+#include <string>
+#include <numeric>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <ranges>
 
-#include <gtest/gtest.h>
+// vectorized partition kernels, picked at runtime by CPUID
+#if defined(__x86_64__) || defined(_M_X64)
+#define QS_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#else
+#define QS_X86_SIMD 0
+#endif
+
+// comparison, swap, recursion and hardware counters for qs::sort, off by default
+#ifndef QS_ENABLE_STATS
+#define QS_ENABLE_STATS 0
+#endif
+#if QS_ENABLE_STATS && defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 // TODO: Reference additional headers your program requires here.
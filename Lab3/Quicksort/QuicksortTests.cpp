@@ -0,0 +1,1109 @@
+#include "Quicksort.cpp"
+#include <gtest/gtest.h>
+#include <vector>
+#include <string>
+#include <numeric>
+#include <cmath>
+#include <fstream>
+#include <filesystem>
+#include <map>
+#include <deque>
+
+TEST(ParallelSort, MatchesStdSortOnRandomInts) {
+    const int N = 1000000;
+    std::vector<int> v(N);
+    std::mt19937_64 rng(12345);
+    for (int i = 0; i < N; ++i) v[i] = std::uniform_int_distribution<int>(-1000000, 1000000)(rng);
+    std::vector<int> expected = v;
+    std::sort(expected.begin(), expected.end());
+
+    qs::parallel_sort(v.data(), v.data() + v.size(), [](int a, int b) { return a < b; }, 4);
+    EXPECT_EQ(v, expected);
+}
+
+TEST(ParallelSort, FewUniqueAndSmallInputs) {
+    std::mt19937_64 rng(777);
+    for (int n : { 0, 1, 2, 10, 1000, 200000 }) {
+        std::vector<int> v(n);
+        for (int i = 0; i < n; ++i) v[i] = std::uniform_int_distribution<int>(0, 3)(rng);
+        std::vector<int> expected = v;
+        std::sort(expected.begin(), expected.end());
+        qs::parallel_sort(v.data(), v.data() + v.size(), [](int a, int b) { return a < b; }, 3);
+        EXPECT_EQ(v, expected) << "n=" << n;
+    }
+}
+
+TEST(ParallelSort, EqualKeysStayLinearWithManyThreads) {
+    const int N = 1 << 20;
+    for (unsigned threads : { 2u, 8u, 32u }) {
+        std::vector<int> v(N, 7);
+        v[N / 3] = 3;
+        v[N / 2] = 9;
+        std::atomic<long long> comparisons{ 0 };
+        qs::parallel_sort(v.data(), v.data() + N, [&](int a, int b) {
+            comparisons.fetch_add(1, std::memory_order_relaxed);
+            return a < b;
+        }, threads);
+        EXPECT_TRUE(std::is_sorted(v.begin(), v.end()));
+        EXPECT_EQ(v.front(), 3);
+        EXPECT_EQ(v.back(), 9);
+        // a pass over the range per thread was the failure mode
+        EXPECT_LT(comparisons.load(), 6LL * N) << "threads=" << threads;
+    }
+}
+
+TEST(ParallelSort, StringsWithCustomComparator) {
+    const int N = 100000;
+    std::vector<std::string> v(N);
+    std::mt19937_64 rng(2024);
+    for (int i = 0; i < N; ++i) v[i] = std::to_string(std::uniform_int_distribution<int>(0, 50000)(rng));
+    auto by_length = [](const std::string& a, const std::string& b) {
+        if (a.size() != b.size()) return a.size() < b.size();
+        return a < b;
+    };
+    std::vector<std::string> expected = v;
+    std::sort(expected.begin(), expected.end(), by_length);
+
+    qs::parallel_sort(v.data(), v.data() + v.size(), by_length, 8);
+    EXPECT_EQ(v, expected);
+}
+
+TEST(ParallelSort, ThrowingComparatorPropagates) {
+    const int N = 1000000;
+    std::mt19937_64 rng(31);
+    std::vector<int> input(N);
+    for (int i = 0; i < N; ++i) input[i] = int(rng());
+    std::vector<int> expected = input;
+    std::sort(expected.begin(), expected.end());
+
+    // early, during the parallel partitions, and late, inside the pool tasks
+    for (long long limit : { 10LL, 1500000LL, 15000000LL }) {
+        std::atomic<long long> comparisons{ 0 };
+        auto throwing = [&](int a, int b) {
+            if (comparisons.fetch_add(1, std::memory_order_relaxed) == limit) throw std::runtime_error("comparator");
+            return a < b;
+        };
+        std::vector<int> v = input;
+        EXPECT_THROW(qs::parallel_sort(v.data(), v.data() + N, throwing, 4), std::runtime_error) << "limit=" << limit;
+        // the elements are still a permutation of the input
+        std::sort(v.begin(), v.end());
+        EXPECT_EQ(v, expected);
+    }
+}
+
+TEST(BlockPartition, SplitsAroundPivot) {
+    std::mt19937_64 rng(99);
+    for (int n : { 3, 50, 129, 130, 1000, 4096 }) {
+        for (int range : { 2, 100, 1000000 }) {
+            std::vector<int> v(n);
+            for (int i = 0; i < n; ++i) v[i] = std::uniform_int_distribution<int>(0, range)(rng);
+            int* pivot = qs::partition(v.data(), v.data() + n, std::less<int>());
+            for (int* it = v.data(); it != pivot; ++it) EXPECT_LE(*it, *pivot);
+            for (int* it = pivot + 1; it != v.data() + n; ++it) EXPECT_GE(*it, *pivot);
+        }
+    }
+}
+
+TEST(BlockPartition, SortWithStandardComparators) {
+    const int N = 300000;
+    std::mt19937_64 rng(4242);
+    std::vector<double> v(N);
+    for (int i = 0; i < N; ++i) v[i] = std::uniform_real_distribution<double>(-1.0, 1.0)(rng);
+    std::vector<double> expected = v;
+
+    qs::sort(v.data(), v.data() + v.size(), std::less<>(), true);
+    std::sort(expected.begin(), expected.end());
+    EXPECT_EQ(v, expected);
+
+    std::shuffle(v.begin(), v.end(), rng);
+    qs::sort(v.data(), v.data() + v.size(), std::greater<double>(), true);
+    std::sort(expected.begin(), expected.end(), std::greater<double>());
+    EXPECT_EQ(v, expected);
+}
+
+// McIlroy's "killer adversary": values are fixed lazily during the sort so
+// that every pivot candidate ends up as small as possible.
+struct AntiQuicksort {
+    std::vector<int> values;
+    int gas;
+    int solid = 0;
+    int candidate = 0;
+    long long comparisons = 0;
+
+    explicit AntiQuicksort(int n) : values(n, n), gas(n) {}
+
+    bool operator()(int x, int y) {
+        ++comparisons;
+        if (values[x] == gas && values[y] == gas) {
+            if (x == candidate) values[x] = solid++;
+            else values[y] = solid++;
+        }
+        if (values[x] == gas) candidate = x;
+        else if (values[y] == gas) candidate = y;
+        return values[x] < values[y];
+    }
+};
+
+TEST(Introsort, AdversaryStaysNLogN) {
+    const int N = 20000;
+    std::vector<int> items(N);
+    std::iota(items.begin(), items.end(), 0);
+    AntiQuicksort adversary(N);
+    qs::sort(items.data(), items.data() + N, [&](int a, int b) { return adversary(a, b); }, true);
+
+    const double n_log_n = N * std::log2(static_cast<double>(N));
+    EXPECT_LT(adversary.comparisons, 8 * n_log_n);
+    for (int i = 1; i < N; ++i) EXPECT_LE(adversary.values[items[i - 1]], adversary.values[items[i]]);
+}
+
+TEST(Introsort, PatternsSortFast) {
+    const int N = 100000;
+    std::vector<std::vector<int>> inputs;
+    std::vector<int> v(N);
+    for (int i = 0; i < N; ++i) v[i] = N - i;
+    inputs.push_back(v); // reversed
+    for (int i = 0; i < N; ++i) v[i] = i < N / 2 ? i : N - i;
+    inputs.push_back(v); // organ pipe
+    for (int i = 0; i < N; ++i) v[i] = i % 1000;
+    inputs.push_back(v); // sawtooth
+
+    for (auto& input : inputs) {
+        long long comparisons = 0;
+        qs::sort(input.data(), input.data() + N, [&](int a, int b) { ++comparisons; return a < b; }, true);
+        EXPECT_TRUE(std::is_sorted(input.begin(), input.end()));
+        EXPECT_LT(comparisons, 4 * N * std::log2(static_cast<double>(N)));
+    }
+}
+
+TEST(ThreeWayPartition, GroupsEqualElements) {
+    std::mt19937_64 rng(5);
+    std::vector<int> v(1000);
+    for (int& x : v) x = std::uniform_int_distribution<int>(0, 4)(rng);
+    auto equal = qs::partition_three_way(v.data(), v.data() + v.size(), std::less<int>());
+    const int pivot = *equal.first;
+    for (int* it = v.data(); it != equal.first; ++it) EXPECT_LT(*it, pivot);
+    for (int* it = equal.first; it != equal.second; ++it) EXPECT_EQ(*it, pivot);
+    for (int* it = equal.second; it != v.data() + v.size(); ++it) EXPECT_GT(*it, pivot);
+}
+
+TEST(ThreeWayPartition, FewDistinctKeysSortInLinearComparisons) {
+    struct Player {
+        int health;
+        int id;
+    };
+    const int N = 1000000;
+    std::vector<Player> v(N);
+    std::mt19937_64 rng(31);
+    for (int i = 0; i < N; ++i) v[i] = { 25 * std::uniform_int_distribution<int>(0, 4)(rng), i };
+
+    long long comparisons = 0;
+    qs::sort(v.data(), v.data() + N, [&](const Player& a, const Player& b) {
+        ++comparisons;
+        return a.health < b.health;
+        }, true);
+
+    for (int i = 1; i < N; ++i) EXPECT_LE(v[i - 1].health, v[i].health);
+    EXPECT_LT(comparisons, 12LL * N);
+}
+
+template<typename T>
+class SimdPartition : public ::testing::Test {};
+
+using SimdKeyTypes = ::testing::Types<std::int32_t, std::int64_t, float, double>;
+TYPED_TEST_SUITE(SimdPartition, SimdKeyTypes);
+
+template<typename T, typename Partition>
+void check_simd_partition(Partition partition) {
+    std::mt19937_64 rng(17);
+    for (int n : { 0, 1, 7, 16, 31, 32, 33, 64, 100, 1000, 12345 }) {
+        for (int range : { 1, 10, 1000000 }) {
+            std::vector<T> v(n);
+            for (T& x : v) x = static_cast<T>(std::uniform_int_distribution<int>(-range, range)(rng));
+            const T pivot = static_cast<T>(std::uniform_int_distribution<int>(-range, range)(rng));
+            std::vector<T> before = v;
+
+            T* split = partition(v.data(), v.data() + n, pivot);
+            for (T* it = v.data(); it != split; ++it) ASSERT_LE(*it, pivot);
+            for (T* it = split; it != v.data() + n; ++it) ASSERT_GE(*it, pivot);
+
+            std::sort(before.begin(), before.end());
+            std::sort(v.begin(), v.end());
+            ASSERT_EQ(v, before) << "n=" << n;
+        }
+    }
+}
+
+TYPED_TEST(SimdPartition, KernelsMatchContract) {
+    using T = TypeParam;
+#if QS_X86_SIMD
+    const qs::detail::simd_level level = qs::detail::cpu_simd_level();
+    if (level == qs::detail::simd_level::none) GTEST_SKIP() << "no AVX2 on this CPU";
+    check_simd_partition<T>([](T* first, T* last, T pivot) { return qs::detail::partition_avx2(first, last, pivot); });
+    if (level == qs::detail::simd_level::avx512) {
+        check_simd_partition<T>([](T* first, T* last, T pivot) { return qs::detail::partition_avx512(first, last, pivot); });
+    }
+#else
+    GTEST_SKIP() << "no x86 SIMD kernels on this target";
+#endif
+}
+
+TYPED_TEST(SimdPartition, SortMatchesStdSort) {
+    using T = TypeParam;
+    std::mt19937_64 rng(3);
+    std::vector<T> v(500000);
+    for (T& x : v) x = static_cast<T>(std::uniform_int_distribution<long long>(-1000000000LL, 1000000000LL)(rng));
+    std::vector<T> expected = v;
+    std::sort(expected.begin(), expected.end());
+    qs::sort(v.data(), v.data() + v.size(), std::less<T>(), true);
+    EXPECT_EQ(v, expected);
+}
+
+template<typename T>
+class RadixSort : public ::testing::Test {};
+
+using RadixKeyTypes = ::testing::Types<std::int8_t, std::uint16_t, std::int32_t, std::uint32_t, std::int64_t, std::uint64_t, float, double>;
+TYPED_TEST_SUITE(RadixSort, RadixKeyTypes);
+
+TYPED_TEST(RadixSort, MatchesStdSort) {
+    using T = TypeParam;
+    std::mt19937_64 rng(8);
+    for (std::size_t n : { 0, 1, 2, 100, 5000, 70000, 1 << 20 }) {
+        std::vector<T> v(n);
+        for (T& x : v) {
+            if constexpr (std::is_floating_point_v<T>) x = static_cast<T>(std::normal_distribution<double>(0.0, 1e6)(rng));
+            else x = static_cast<T>(rng());
+        }
+        std::vector<T> expected = v;
+        std::sort(expected.begin(), expected.end());
+        qs::radix_sort(v.data(), v.data() + v.size());
+        EXPECT_EQ(v, expected) << "n=" << n;
+    }
+}
+
+TEST(RadixSort, FloatSpecialValues) {
+    const double inf = std::numeric_limits<double>::infinity();
+    std::vector<double> v = { 3.5, -0.0, inf, -1e-300, 0.0, -inf, 1e-300, -2.25, 42.0, -42.0 };
+    qs::radix_sort(v.data(), v.data() + v.size());
+    EXPECT_TRUE(std::is_sorted(v.begin(), v.end()));
+    EXPECT_EQ(v.front(), -inf);
+    EXPECT_EQ(v.back(), inf);
+}
+
+TEST(RadixSort, SortDispatchesLargeKeyRanges) {
+    std::mt19937_64 rng(9);
+    std::vector<std::int64_t> v(qs::radix_sort_threshold * 2);
+    for (std::int64_t& x : v) x = static_cast<std::int64_t>(rng());
+    std::vector<std::int64_t> expected = v;
+    std::sort(expected.begin(), expected.end());
+    qs::sort(v.data(), v.data() + v.size(), std::less<>(), true);
+    EXPECT_EQ(v, expected);
+}
+
+TEST(SortingNetwork, SortsAllZeroOneInputs) {
+    // 0-1 principle: a network that sorts every 0/1 input sorts every input
+    for (int n = 0; n <= qs::max_network_size; ++n) {
+        std::vector<int> v(n);
+        for (unsigned mask = 0; mask < (1u << n); ++mask) {
+            for (int i = 0; i < n; ++i) v[i] = (mask >> i) & 1;
+            qs::small_sort(v.data(), v.data() + n, std::less<int>());
+            ASSERT_TRUE(std::is_sorted(v.begin(), v.end())) << "n=" << n << " mask=" << mask;
+        }
+    }
+}
+
+TEST(SortingNetwork, RandomSmallRanges) {
+    struct Key {
+        int major;
+        int minor;
+    };
+    auto comp = [](const Key& a, const Key& b) {
+        if (a.major != b.major) return a.major < b.major;
+        return a.minor < b.minor;
+    };
+    std::mt19937_64 rng(16);
+    for (int trial = 0; trial < 2000; ++trial) {
+        const int n = trial % (qs::max_network_size + 1);
+        std::vector<Key> v(n);
+        for (Key& k : v) k = { std::uniform_int_distribution<int>(0, 5)(rng), std::uniform_int_distribution<int>(0, 5)(rng) };
+        std::vector<Key> expected = v;
+        std::sort(expected.begin(), expected.end(), comp);
+        qs::small_sort(v.data(), v.data() + n, comp);
+        for (int i = 0; i < n; ++i) {
+            EXPECT_EQ(v[i].major, expected[i].major);
+            EXPECT_EQ(v[i].minor, expected[i].minor);
+        }
+    }
+}
+
+struct Player {
+    int armor;
+    int health;
+    std::string name;
+};
+
+TEST(SortByKey, CallsKeyOncePerElement) {
+    std::mt19937_64 rng(9);
+    std::vector<Player> v;
+    for (int i = 0; i < 20000; ++i) {
+        v.push_back({ int(rng() % 100), int(rng() % 1000), "p" + std::to_string(i) });
+    }
+    std::vector<Player> expected = v;
+
+    std::size_t calls = 0;
+    qs::sort_by_key(v.data(), v.data() + v.size(), [&calls](const Player& p) {
+        ++calls;
+        return p.armor * 1000 + p.health;
+    });
+    EXPECT_EQ(calls, v.size());
+
+    // packed integer keys keep equal keys in input order
+    std::stable_sort(expected.begin(), expected.end(), [](const Player& a, const Player& b) {
+        return a.armor * 1000 + a.health < b.armor * 1000 + b.health;
+    });
+    for (std::size_t i = 0; i < v.size(); ++i) {
+        ASSERT_EQ(v[i].name, expected[i].name);
+    }
+}
+
+TEST(SortByKey, GenericKeysAndComparator) {
+    std::mt19937_64 rng(10);
+    std::vector<Player> v;
+    for (int i = 0; i < 5000; ++i) {
+        v.push_back({ int(rng() % 10), int(rng() % 10), "p" + std::to_string(rng() % 3000) });
+    }
+    std::vector<std::string> names;
+    for (const Player& p : v) names.push_back(p.name);
+
+    std::size_t calls = 0;
+    qs::sort_by_key(v.data(), v.data() + v.size(), [&calls](const Player& p) {
+        ++calls;
+        return p.name;
+    }, std::greater<>());
+    EXPECT_EQ(calls, v.size());
+
+    std::sort(names.begin(), names.end(), std::greater<>());
+    for (std::size_t i = 0; i < v.size(); ++i) {
+        ASSERT_EQ(v[i].name, names[i]);
+    }
+}
+
+TEST(SortByKey, LargeRangeUsesRadixPath) {
+    const std::size_t N = 300000;
+    std::mt19937_64 rng(11);
+    std::vector<std::pair<float, int>> v(N);
+    for (std::size_t i = 0; i < N; ++i) v[i] = { std::uniform_real_distribution<float>(-1e3f, 1e3f)(rng), int(i) };
+    std::vector<std::pair<float, int>> expected = v;
+
+    qs::sort_by_key(v.data(), v.data() + N, [](const std::pair<float, int>& p) { return p.first; });
+    std::stable_sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    EXPECT_EQ(v, expected);
+}
+
+TEST(SortByKey, SignedZerosKeepInputOrder) {
+    const int N = 1000;
+    std::vector<std::pair<float, int>> v(N);
+    for (int i = 0; i < N; ++i) v[i] = { i % 3 == 0 ? 1.0f : (i % 2 ? -0.0f : 0.0f), i };
+    std::vector<std::pair<float, int>> expected = v;
+
+    qs::sort_by_key(v.data(), v.data() + N, [](const std::pair<float, int>& p) { return p.first; });
+    std::stable_sort(expected.begin(), expected.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    // -0.0f == 0.0f, so compare the ids and the sign bits
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(v[i].second, expected[i].second);
+        ASSERT_EQ(std::signbit(v[i].first), std::signbit(expected[i].first));
+    }
+}
+
+struct HeavyPlayer {
+    int level;
+    std::vector<std::string> inventory;
+};
+
+TEST(Argsort, ApplyPermutationMovesEachObjectOnce) {
+    std::mt19937_64 rng(12);
+    std::vector<HeavyPlayer> v;
+    for (int i = 0; i < 3000; ++i) {
+        v.push_back({ int(rng() % 500), { "sword" + std::to_string(i), "shield", "potion" } });
+    }
+    auto by_level = [](const HeavyPlayer& a, const HeavyPlayer& b) { return a.level < b.level; };
+
+    std::vector<std::size_t> order = qs::argsort(v.data(), v.data() + v.size(), by_level);
+    ASSERT_EQ(order.size(), v.size());
+    for (std::size_t i = 1; i < order.size(); ++i) {
+        ASSERT_FALSE(by_level(v[order[i]], v[order[i - 1]]));
+    }
+
+    std::vector<std::string> expected;
+    for (std::size_t i : order) expected.push_back(v[i].inventory[0]);
+    qs::apply_permutation(v.data(), v.data() + v.size(), order.data());
+    EXPECT_TRUE(std::is_sorted(v.begin(), v.end(), by_level));
+    for (std::size_t i = 0; i < v.size(); ++i) {
+        ASSERT_EQ(v[i].inventory[0], expected[i]);
+    }
+}
+
+TEST(Argsort, RejectsInvalidPermutation) {
+    std::vector<int> v = { 1, 2, 3, 4 };
+    const std::vector<int> duplicate = { 0, 1, 1, 3 };
+    const std::vector<int> out_of_range = { 0, 1, 2, 4 };
+    EXPECT_THROW(qs::apply_permutation(v.data(), v.data() + v.size(), duplicate.data()), std::invalid_argument);
+    EXPECT_THROW(qs::apply_permutation(v.data(), v.data() + v.size(), out_of_range.data()), std::invalid_argument);
+    EXPECT_EQ(v, std::vector<int>({ 1, 2, 3, 4 }));
+
+    const std::vector<int> reverse = { 3, 2, 1, 0 };
+    qs::apply_permutation(v.data(), v.data() + v.size(), reverse.data());
+    EXPECT_EQ(v, std::vector<int>({ 4, 3, 2, 1 }));
+}
+
+struct Record {
+    std::uint64_t key;
+    std::uint32_t id;
+    std::uint32_t payload;
+};
+
+std::vector<Record> write_random_records(const std::filesystem::path& path, std::size_t n, std::uint64_t seed) {
+    std::vector<Record> records(n);
+    std::mt19937_64 rng(seed);
+    for (std::size_t i = 0; i < n; ++i) {
+        records[i] = { rng() % 100000, static_cast<std::uint32_t>(i), static_cast<std::uint32_t>(rng()) };
+    }
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+    return records;
+}
+
+std::vector<Record> read_records(const std::filesystem::path& path) {
+    std::vector<Record> records(std::filesystem::file_size(path) / sizeof(Record));
+    std::ifstream in(path, std::ios::binary);
+    in.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(Record));
+    return records;
+}
+
+// A directory of the running test's own under the system temp directory,
+// removed with its contents at the end of the test.
+struct scratch_directory {
+    std::filesystem::path path;
+
+    scratch_directory() {
+        const ::testing::TestInfo* test = ::testing::UnitTest::GetInstance()->current_test_info();
+        path = std::filesystem::temp_directory_path() /
+            ("qs_" + std::string(test->test_suite_name()) + "_" + test->name() + "_" + std::to_string(std::random_device()()));
+        std::filesystem::create_directories(path);
+    }
+
+    ~scratch_directory() {
+        std::error_code error;
+        std::filesystem::remove_all(path, error);
+    }
+};
+
+bool has_spilled_runs(const std::filesystem::path& dir) {
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.path().filename().string().rfind("qs_run_", 0) == 0) return true;
+    }
+    return false;
+}
+
+TEST(ExternalSort, MultiPassMergeMatchesInMemorySort) {
+    const scratch_directory dir;
+    const std::filesystem::path input = dir.path / "input.bin";
+    const std::filesystem::path output = dir.path / "output.bin";
+    std::vector<Record> expected = write_random_records(input, 50000, 1);
+
+    auto by_key = [](const Record& a, const Record& b) {
+        if (a.key != b.key) return a.key < b.key;
+        return a.id < b.id;
+    };
+    qs::external_sort_options options;
+    // 64 KiB of memory for 800 KB of records: 13 runs, fan-in 7, two merge passes
+    options.memory_budget = 64 << 10;
+    options.io_block_size = 4 << 10;
+    options.temp_directory = dir.path;
+    qs::external_sort<Record>(input, output, by_key, options);
+
+    std::sort(expected.begin(), expected.end(), by_key);
+    std::vector<Record> sorted = read_records(output);
+    ASSERT_EQ(sorted.size(), expected.size());
+    for (std::size_t i = 0; i < sorted.size(); ++i) {
+        ASSERT_EQ(sorted[i].key, expected[i].key);
+        ASSERT_EQ(sorted[i].id, expected[i].id);
+        ASSERT_EQ(sorted[i].payload, expected[i].payload);
+    }
+
+    // spilled runs are cleaned up
+    EXPECT_FALSE(has_spilled_runs(dir.path));
+}
+
+TEST(ExternalSort, SmallAndEmptyInputs) {
+    const scratch_directory dir;
+    const std::filesystem::path input = dir.path / "input.bin";
+    const std::filesystem::path output = dir.path / "output.bin";
+    auto by_key = [](const Record& a, const Record& b) { return a.key < b.key; };
+    qs::external_sort_options options;
+    options.temp_directory = dir.path;
+
+    for (std::size_t n : { 0, 1, 1000 }) {
+        write_random_records(input, n, n);
+        qs::external_sort<Record>(input, output, by_key, options);
+        std::vector<Record> sorted = read_records(output);
+        EXPECT_EQ(sorted.size(), n);
+        EXPECT_TRUE(std::is_sorted(sorted.begin(), sorted.end(), by_key));
+    }
+    EXPECT_FALSE(has_spilled_runs(dir.path));
+}
+
+TEST(ExternalSort, BudgetBelowTwoBlocksShrinksBlocks) {
+    const scratch_directory dir;
+    const std::filesystem::path input = dir.path / "input.bin";
+    const std::filesystem::path output = dir.path / "output.bin";
+    std::vector<Record> expected = write_random_records(input, 20000, 8);
+    auto by_key = [](const Record& a, const Record& b) {
+        if (a.key != b.key) return a.key < b.key;
+        return a.id < b.id;
+    };
+
+    // 16 KiB against the default 1 MiB block: 20 runs, merged a few at a time
+    qs::external_sort_options options;
+    options.memory_budget = 16 << 10;
+    options.temp_directory = dir.path;
+    qs::external_sort<Record>(input, output, by_key, options);
+
+    std::sort(expected.begin(), expected.end(), by_key);
+    std::vector<Record> sorted = read_records(output);
+    ASSERT_EQ(sorted.size(), expected.size());
+    for (std::size_t i = 0; i < sorted.size(); ++i) ASSERT_EQ(sorted[i].id, expected[i].id);
+
+    options.memory_budget = 0;
+    EXPECT_THROW(qs::external_sort<Record>(input, output, by_key, options), std::invalid_argument);
+    EXPECT_FALSE(has_spilled_runs(dir.path));
+}
+
+void check_nth_element(std::vector<int> v, std::size_t n, long long max_comparisons) {
+    std::vector<int> expected = v;
+    std::sort(expected.begin(), expected.end());
+    long long comparisons = 0;
+    auto counting = [&](int a, int b) { ++comparisons; return a < b; };
+    qs::nth_element(v.data(), v.data() + n, v.data() + v.size(), counting);
+    ASSERT_EQ(v[n], expected[n]);
+    for (std::size_t i = 0; i < n; ++i) ASSERT_LE(v[i], v[n]);
+    for (std::size_t i = n + 1; i < v.size(); ++i) ASSERT_GE(v[i], v[n]);
+    EXPECT_LT(comparisons, max_comparisons);
+}
+
+TEST(Selection, NthElementIsLinearOnPatterns) {
+    const int N = 200000;
+    std::mt19937_64 rng(13);
+    std::vector<int> v(N);
+    for (int i = 0; i < N; ++i) v[i] = int(rng());
+    for (std::size_t n : { std::size_t(0), std::size_t(100), std::size_t(N / 2), std::size_t(N - 1) }) {
+        check_nth_element(v, n, 8LL * N);
+    }
+    for (int i = 0; i < N; ++i) v[i] = i < N / 2 ? i : N - i;
+    check_nth_element(v, N / 2, 8LL * N); // organ pipe
+    for (int i = 0; i < N; ++i) v[i] = i % 3;
+    check_nth_element(v, N / 3, 8LL * N); // few distinct
+    std::fill(v.begin(), v.end(), 7);
+    check_nth_element(v, N / 2, 8LL * N); // all equal
+}
+
+TEST(Selection, NthElementSurvivesAdversary) {
+    const int N = 20000;
+    std::vector<int> items(N);
+    std::iota(items.begin(), items.end(), 0);
+    AntiQuicksort adversary(N);
+    qs::nth_element(items.data(), items.data() + N / 2, items.data() + N, [&](int a, int b) { return adversary(a, b); });
+
+    EXPECT_LT(adversary.comparisons, 40LL * N);
+    for (int i = 0; i < N / 2; ++i) ASSERT_LE(adversary.values[items[i]], adversary.values[items[N / 2]]);
+    for (int i = N / 2 + 1; i < N; ++i) ASSERT_GE(adversary.values[items[i]], adversary.values[items[N / 2]]);
+}
+
+TEST(Selection, MedianOfMediansFallback) {
+    const int N = 50000;
+    std::mt19937_64 rng(14);
+    std::vector<int> v(N);
+    for (int i = 0; i < N; ++i) v[i] = int(rng() % 1000);
+    std::vector<int> expected = v;
+    std::sort(expected.begin(), expected.end());
+    // forced fallback, every pivot comes from median of medians
+    qs::detail::select_loop(v.data(), v.data() + N / 3, v.data() + N, std::less<int>(), true, true);
+    EXPECT_EQ(v[N / 3], expected[N / 3]);
+    for (int i = 0; i < N / 3; ++i) ASSERT_LE(v[i], v[N / 3]);
+}
+
+TEST(Selection, PartialSortAndTopK) {
+    const int N = 100000;
+    std::mt19937_64 rng(15);
+    std::vector<std::string> v(N);
+    for (int i = 0; i < N; ++i) v[i] = std::to_string(rng() % 50000);
+    std::vector<std::string> expected = v;
+    std::sort(expected.begin(), expected.end(), std::greater<>());
+    expected.resize(100);
+
+    qs::top_k<std::string, std::greater<>> top(100);
+    top.push(v.begin(), v.end());
+    EXPECT_EQ(top.size(), 100u);
+    EXPECT_EQ(top.sorted(), expected);
+
+    qs::partial_sort(v.data(), v.data() + 100, v.data() + N, std::greater<>());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), v.begin()));
+
+    qs::top_k<int> none(0);
+    none.push(1);
+    EXPECT_EQ(none.size(), 0u);
+}
+
+TEST(AdaptiveSort, PresortedInputIsLinear) {
+    const int N = 100000;
+    std::vector<int> sorted(N);
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::vector<int> reversed(sorted.rbegin(), sorted.rend());
+
+    for (std::vector<int> v : { sorted, reversed }) {
+        long long comparisons = 0;
+        qs::adaptive_sort(v.data(), v.data() + N, [&](int a, int b) { ++comparisons; return a < b; });
+        EXPECT_EQ(v, sorted);
+        EXPECT_EQ(comparisons, N - 1);
+    }
+}
+
+TEST(AdaptiveSort, SortedWithAppendedUpdates) {
+    const int N = 100000;
+    std::mt19937_64 rng(16);
+    std::vector<int> v(N);
+    std::iota(v.begin(), v.end(), 0);
+    for (int i = 0; i < 500; ++i) v.push_back(int(rng() % N));
+    std::vector<int> expected = v;
+    std::sort(expected.begin(), expected.end());
+
+    long long comparisons = 0;
+    qs::adaptive_sort(v.data(), v.data() + v.size(), [&](int a, int b) { ++comparisons; return a < b; });
+    EXPECT_EQ(v, expected);
+    EXPECT_LT(comparisons, 3LL * N);
+}
+
+TEST(AdaptiveSort, MatchesStdSortOnMixedPatterns) {
+    const int N = 50000;
+    std::mt19937_64 rng(17);
+    std::vector<std::vector<std::string>> inputs;
+    std::vector<std::string> v(N);
+    for (int i = 0; i < N; ++i) v[i] = std::to_string(rng() % 10000);
+    inputs.push_back(v); // random, falls back to quicksort
+    for (int i = 0; i < N; i += 1000) {
+        std::sort(v.begin() + i, v.begin() + i + 1000);
+        if (i % 3000 == 0) std::reverse(v.begin() + i, v.begin() + i + 1000);
+    }
+    inputs.push_back(v); // ascending and descending runs
+    for (int i = 0; i < N; i += 1000) std::shuffle(v.begin() + i, v.begin() + i + 20, rng);
+    inputs.push_back(v); // runs with short unsorted stretches
+
+    for (auto& input : inputs) {
+        std::vector<std::string> expected = input;
+        std::sort(expected.begin(), expected.end());
+        qs::adaptive_sort(input.data(), input.data() + input.size(), std::less<>());
+        EXPECT_EQ(input, expected);
+    }
+}
+
+TEST(AdaptiveSort, ThrowingComparatorLosesNoElements) {
+    const int N = 4000;
+    std::vector<std::string> v(N);
+    for (int i = 0; i < N; ++i) v[i] = std::to_string(i % 2000 * 2 + i / 2000);
+    std::sort(v.begin(), v.begin() + N / 2);
+    std::sort(v.begin() + N / 2, v.end());
+    std::vector<std::string> expected = v;
+    std::sort(expected.begin(), expected.end());
+
+    int budget = 3000;
+    EXPECT_THROW(qs::adaptive_sort(v.data(), v.data() + N, [&](const std::string& a, const std::string& b) {
+        if (--budget == 0) throw std::runtime_error("comparator failed");
+        return a < b;
+    }), std::runtime_error);
+    std::sort(v.begin(), v.end());
+    EXPECT_EQ(v, expected);
+}
+
+class counting_resource : public std::pmr::memory_resource {
+public:
+    int allocations = 0;
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        ++allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+        std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+std::vector<std::pair<int, int>> keys_with_sequence(int n, std::uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<std::pair<int, int>> v(n);
+    for (int i = 0; i < n; ++i) v[i] = { int(rng() % 100), i };
+    return v;
+}
+
+TEST(StableSort, KeepsEqualKeysInOrderWithEveryBuffer) {
+    auto by_key = [](const std::pair<int, int>& a, const std::pair<int, int>& b) { return a.first < b.first; };
+    for (int n : { 0, 1, 15, 16, 17, 1000, 30001 }) {
+        std::vector<std::pair<int, int>> expected = keys_with_sequence(n, n);
+        std::stable_sort(expected.begin(), expected.end(), by_key);
+
+        std::vector<std::pair<int, int>> v = keys_with_sequence(n, n);
+        qs::scratch_buffer<std::pair<int, int>> heap;
+        qs::stable_sort(v.data(), v.data() + n, by_key, heap);
+        EXPECT_EQ(v, expected);
+
+        // fixed storage far below n / 2, most merges run in place
+        alignas(std::pair<int, int>) unsigned char memory[1024];
+        qs::scratch_buffer<std::pair<int, int>> fixed(memory, sizeof(memory));
+        v = keys_with_sequence(n, n);
+        qs::stable_sort(v.data(), v.data() + n, by_key, fixed);
+        EXPECT_EQ(v, expected);
+        EXPECT_EQ(fixed.capacity(), sizeof(memory) / sizeof(std::pair<int, int>));
+
+        v = keys_with_sequence(n, n);
+        qs::stable_sort(v.data(), v.data() + n, by_key);
+        EXPECT_EQ(v, expected);
+    }
+}
+
+TEST(StableSort, ReusedBufferDoesNotAllocate) {
+    counting_resource resource;
+    qs::scratch_buffer<std::string> buffer(&resource);
+    std::mt19937_64 rng(18);
+    for (int round = 0; round < 5; ++round) {
+        std::vector<std::string> v(20000);
+        for (auto& s : v) s = std::to_string(rng() % 5000);
+        std::vector<std::string> expected = v;
+        std::stable_sort(expected.begin(), expected.end());
+        qs::stable_sort(v.data(), v.data() + v.size(), std::less<>(), buffer);
+        EXPECT_EQ(v, expected);
+    }
+    EXPECT_EQ(resource.allocations, 1);
+}
+
+#if QS_ENABLE_STATS
+TEST(SortStats, CountsWhatTheSortDid) {
+    const int N = 100000;
+    std::mt19937_64 rng(19);
+    std::vector<int> v(N);
+    for (int& x : v) x = int(rng());
+    long long comparisons = 0;
+    qs::sort(v.data(), v.data() + N, [&](int a, int b) { ++comparisons; return a < b; }, true);
+
+    const qs::sort_stats& stats = qs::last_sort_stats();
+    EXPECT_EQ(stats.comparisons, static_cast<std::uint64_t>(comparisons));
+    EXPECT_GT(stats.swaps, 0u);
+    EXPECT_GT(stats.partitions, 0u);
+    EXPECT_GE(stats.max_depth, 1);
+    EXPECT_LE(stats.max_depth, 2 * 17);
+    EXPECT_LT(stats.mean_imbalance(), 0.5);
+
+    // a second call starts from zero
+    std::vector<int> small = { 3, 1, 2 };
+    qs::sort(small.data(), small.data() + 3, std::less<int>(), true);
+    EXPECT_LT(qs::last_sort_stats().comparisons, 10u);
+}
+#else
+TEST(SortStats, DisabledBuildsCollectNothing) {
+    std::vector<int> v = { 5, 3, 9, 1, 7, 2, 8, 6, 4, 0, 11, 10 };
+    qs::sort(v.data(), v.data() + v.size(), std::greater<int>(), true);
+    EXPECT_EQ(qs::last_sort_stats().comparisons, 0u);
+    EXPECT_EQ(qs::last_sort_stats().cycles, -1);
+    static_assert(std::is_empty_v<qs::detail::stats_scope> && std::is_empty_v<qs::detail::recursion_level>);
+}
+#endif
+
+TEST(Tuning, FileRoundTripSkipsMalformedLines) {
+    const scratch_directory dir;
+    const std::filesystem::path path = dir.path / "qs_tuning.txt";
+    std::map<std::string, qs::sort_tuning> entries;
+    entries["i32"] = { 16, 1 << 15, 1 << 14 };
+    entries["object200"] = { 6, 1 << 12, 1 << 20 };
+    qs::save_tuning(path, entries);
+    {
+        std::ofstream append(path, std::ios::app);
+        append << "f64 0 100 100\n"    // threshold too small
+            << "u64 12 oops 4096\n"    // not a number
+            << "# comment line\n\n";
+    }
+
+    const auto loaded = qs::detail::read_tuning_file(path);
+    ASSERT_EQ(loaded.size(), 2u);
+    EXPECT_EQ(loaded.at("i32").insertion_threshold, 16);
+    EXPECT_EQ(loaded.at("i32").parallel_cutoff, 1 << 15);
+    EXPECT_EQ(loaded.at("object200").radix_threshold, 1 << 20);
+    EXPECT_THROW(qs::load_tuning(path.string() + ".missing"), std::runtime_error);
+
+    EXPECT_EQ(qs::tuning_key<int>(), "i32");
+    EXPECT_EQ(qs::tuning_key<std::uint64_t>(), "u64");
+    EXPECT_EQ(qs::tuning_key<double>(), "f64");
+    EXPECT_EQ(qs::tuning_key<Record>(), "object16");
+}
+
+TEST(Tuning, LoadReplacesCutoffsOfResolvedTypes) {
+    // resolved before any load: the defaults, nothing is read implicitly
+    EXPECT_EQ(qs::tuning_for<std::int16_t>().insertion_threshold, qs::insertion_threshold);
+
+    const scratch_directory dir;
+    const std::filesystem::path path = dir.path / "qs_tuning.txt";
+    qs::save_tuning(path, { { "i16", { 24, 1 << 12, 1 << 10 } } });
+    qs::load_tuning(path);
+    EXPECT_EQ(qs::tuning_for<std::int16_t>().insertion_threshold, 24);
+    EXPECT_EQ(qs::tuning_for<std::int16_t>().radix_threshold, 1 << 10);
+    EXPECT_EQ(qs::tuning_for<std::int8_t>().insertion_threshold, qs::insertion_threshold);
+
+    std::mt19937_64 rng(19);
+    std::vector<std::int16_t> v(5000);
+    for (auto& x : v) x = std::int16_t(rng());
+    std::vector<std::int16_t> expected = v;
+    std::sort(expected.begin(), expected.end());
+    qs::sort(v.data(), v.data() + v.size(), std::less<>(), true);
+    EXPECT_EQ(v, expected);
+
+    // a file without the entry puts the defaults back
+    qs::save_tuning(path, {});
+    qs::load_tuning(path);
+    EXPECT_EQ(qs::tuning_for<std::int16_t>().insertion_threshold, qs::insertion_threshold);
+}
+
+TEST(Tuning, SortHonoursOverriddenCutoffs) {
+    const qs::sort_tuning saved = qs::tuning_for<std::int64_t>();
+    std::mt19937_64 rng(20);
+    for (std::ptrdiff_t threshold : { 2, 3, 16, 64 }) {
+        qs::sort_tuning tuning = saved;
+        tuning.insertion_threshold = threshold;
+        tuning.radix_threshold = 1000;
+        tuning.parallel_cutoff = 256;
+        qs::set_tuning<std::int64_t>(tuning);
+
+        for (int n : { 500, 5000 }) {
+            std::vector<std::int64_t> v(n);
+            for (auto& x : v) x = std::int64_t(rng() % 1000);
+            std::vector<std::int64_t> expected = v;
+            std::sort(expected.begin(), expected.end());
+            std::vector<std::int64_t> w = v;
+            qs::sort(v.data(), v.data() + n, std::less<std::int64_t>(), true);
+            qs::parallel_sort(w.data(), w.data() + n, std::less<std::int64_t>(), 4);
+            EXPECT_EQ(v, expected);
+            EXPECT_EQ(w, expected);
+        }
+    }
+    qs::set_tuning<std::int64_t>(saved);
+}
+
+TEST(SegmentedSort, SortsEverySegment) {
+    std::mt19937_64 rng(21);
+    std::vector<std::size_t> offsets = { 0 };
+    for (int s = 0; s < 3000; ++s) offsets.push_back(offsets.back() + rng() % 600);
+    offsets.push_back(offsets.back());              // empty segment
+    offsets.push_back(offsets.back() + 300000);     // bigger than a thread's share
+    offsets.push_back(offsets.back() + 1);
+
+    std::vector<std::int64_t> input(offsets.back());
+    for (auto& x : input) x = std::int64_t(rng() % 1000) - 500;
+    std::vector<std::int64_t> expected = input;
+    for (std::size_t s = 0; s + 1 < offsets.size(); ++s) {
+        std::sort(expected.begin() + offsets[s], expected.begin() + offsets[s + 1], std::greater<>());
+    }
+
+    for (unsigned threads : { 1u, 4u }) {
+        std::vector<std::int64_t> v = input;
+        qs::segmented_sort(v.data(), offsets.data(), offsets.data() + offsets.size(), std::greater<>(), threads);
+        EXPECT_EQ(v, expected);
+    }
+}
+
+TEST(SegmentedSort, SmallSegmentsOfStringsAndBadOffsets) {
+    std::mt19937_64 rng(22);
+    std::vector<int> offsets = { 0 };
+    for (int s = 0; s < 500; ++s) offsets.push_back(offsets.back() + int(rng() % 20));
+    std::vector<std::string> v(offsets.back());
+    for (auto& x : v) x = std::to_string(rng() % 100);
+    std::vector<std::string> expected = v;
+    for (std::size_t s = 0; s + 1 < offsets.size(); ++s) {
+        std::sort(expected.begin() + offsets[s], expected.begin() + offsets[s + 1]);
+    }
+    qs::segmented_sort(v.data(), offsets.data(), offsets.data() + offsets.size(), std::less<>());
+    EXPECT_EQ(v, expected);
+
+    const std::vector<int> decreasing = { 0, 5, 3 };
+    EXPECT_THROW(qs::segmented_sort(v.data(), decreasing.data(), decreasing.data() + 3, std::less<>()), std::invalid_argument);
+    qs::segmented_sort(v.data(), offsets.data(), offsets.data() + 1, std::less<>());
+}
+
+TEST(IteratorSort, SortsContiguousContainersInPlace) {
+    std::vector<int> v;
+    std::mt19937 rng(18);
+    for (int i = 0; i < 5000; ++i) v.push_back(std::uniform_int_distribution<int>(-1000, 1000)(rng));
+    std::vector<int> expected = v;
+    std::sort(expected.begin(), expected.end());
+    const int* storage = v.data();
+
+    qs::sort(v);
+    EXPECT_EQ(v.data(), storage);
+    EXPECT_EQ(v, expected);
+
+    qs::sort(v.begin(), v.end(), std::greater<int>());
+    EXPECT_TRUE(std::equal(v.begin(), v.end(), expected.rbegin(), expected.rend()));
+
+    std::array<std::string, 5> words = { "pear", "fig", "apple", "kiwi", "date" };
+    qs::sort(words);
+    EXPECT_EQ(words, (std::array<std::string, 5>{ "apple", "date", "fig", "kiwi", "pear" }));
+}
+
+TEST(IteratorSort, NonContiguousIterators) {
+    std::mt19937 rng(19);
+    for (int n : { 0, 1, 2, 3, 17, 1000, 100000 }) {
+        std::deque<int> d;
+        for (int i = 0; i < n; ++i) d.push_back(std::uniform_int_distribution<int>(0, n / 4 + 1)(rng));
+        std::vector<int> expected(d.begin(), d.end());
+        std::sort(expected.begin(), expected.end());
+
+        qs::sort(d.begin(), d.end());
+        EXPECT_TRUE(std::equal(d.begin(), d.end(), expected.begin(), expected.end())) << n;
+    }
+
+    // organ pipe input through the non-insertion-sort path
+    std::deque<int> d;
+    for (int i = 0; i < 50000; ++i) d.push_back(i < 25000 ? i : 50000 - i);
+    qs::sort(d.begin(), d.end(), std::less<int>(), false);
+    EXPECT_TRUE(std::is_sorted(d.begin(), d.end()));
+}
+
+TEST(IteratorSort, Ranges) {
+    std::vector<std::string> words = { "pear", "apple", "fig", "banana", "cherry" };
+    qs::sort(words);
+    EXPECT_EQ(words, (std::vector<std::string>{ "apple", "banana", "cherry", "fig", "pear" }));
+
+    std::array<double, 6> values = { 3.5, -1.0, 2.25, 0.0, 8.0, -7.5 };
+    qs::sort(values, std::greater<>());
+    EXPECT_TRUE(std::is_sorted(values.begin(), values.end(), std::greater<>()));
+
+    // only the first half, through a view
+    std::vector<int> v = { 5, 4, 3, 2, 1, 0 };
+    qs::sort(std::views::take(v, 3));
+    EXPECT_EQ(v, (std::vector<int>{ 3, 4, 5, 2, 1, 0 }));
+}
+
+TEST(KwayMerge, LoserTreeOrderAndTies) {
+    std::vector<int> a = { 1, 4, 4, 9 }, c = { 0, 4, 10 };
+    std::vector<const int*> heads = { a.data(), nullptr, c.data() };
+    qs::loser_tree<int> tree(heads);
+    ASSERT_FALSE(tree.empty());
+    EXPECT_EQ(tree.top(), 2u);
+    EXPECT_EQ(tree.top_value(), 0);
+    tree.replace_top(c.data() + 1);
+    EXPECT_EQ(tree.top(), 0u);
+    tree.replace_top(a.data() + 1);
+    // equal heads go to the lower index
+    EXPECT_EQ(tree.top(), 0u);
+    EXPECT_EQ(tree.top_value(), 4);
+
+    qs::loser_tree<int> none(std::vector<const int*>{});
+    EXPECT_TRUE(none.empty());
+    qs::loser_tree<int> exhausted(std::vector<const int*>{ nullptr });
+    EXPECT_TRUE(exhausted.empty());
+}
+
+TEST(KwayMerge, MatchesStableSortOfConcatenation) {
+    std::mt19937 rng(1919);
+    for (int k : { 0, 1, 2, 3, 7, 64, 300 }) {
+        // keys with many duplicates, the payload records run and position
+        std::vector<std::vector<std::pair<int, int>>> shards(k);
+        std::vector<std::pair<int, int>> expected;
+        for (int r = 0; r < k; ++r) {
+            const int n = std::uniform_int_distribution<int>(0, 2000)(rng);
+            for (int i = 0; i < n; ++i) shards[r].emplace_back(std::uniform_int_distribution<int>(0, 500)(rng), r * 100000 + i);
+            std::stable_sort(shards[r].begin(), shards[r].end(), [](auto& x, auto& y) { return x.first < y.first; });
+            expected.insert(expected.end(), shards[r].begin(), shards[r].end());
+        }
+        auto by_key = [](const std::pair<int, int>& x, const std::pair<int, int>& y) { return x.first < y.first; };
+        std::stable_sort(expected.begin(), expected.end(), by_key);
+
+        std::vector<qs::sorted_run<std::pair<int, int>>> runs;
+        for (auto& shard : shards) runs.emplace_back(shard.data(), shard.data() + shard.size());
+
+        std::vector<std::pair<int, int>> merged(expected.size());
+        EXPECT_EQ(qs::kway_merge(runs, merged.data(), by_key), merged.data() + merged.size());
+        EXPECT_EQ(merged, expected) << k;
+
+        std::vector<std::pair<int, int>> parallel(expected.size());
+        qs::set_tuning<std::pair<int, int>>({ qs::insertion_threshold, 64, qs::radix_sort_threshold });
+        EXPECT_EQ(qs::parallel_kway_merge(runs, parallel.data(), by_key, 4), parallel.data() + parallel.size());
+        qs::set_tuning<std::pair<int, int>>({});
+        EXPECT_EQ(parallel, expected) << k;
+    }
+}
+
+TEST(KwayMerge, MergePathSplitsAreConsistent) {
+    std::vector<int> a = { 1, 2, 2, 2, 5 }, b = { 2, 2, 3 }, c = { 0, 2, 6, 7 };
+    std::vector<qs::sorted_run<int>> runs = { { a.data(), a.data() + a.size() }, { b.data(), b.data() + b.size() }, { c.data(), c.data() + c.size() } };
+    std::vector<std::size_t> previous(3, 0);
+    for (std::size_t rank = 0; rank <= 12; ++rank) {
+        std::vector<std::size_t> split = qs::merge_path(runs, rank, std::less<int>());
+        EXPECT_EQ(split[0] + split[1] + split[2], rank);
+        for (int i = 0; i < 3; ++i) EXPECT_GE(split[i], previous[i]);
+        previous = split;
+    }
+    // the first five of 0 1 2a 2a 2a 2b 2b 2c ... take every 2 of a before b's
+    EXPECT_EQ(qs::merge_path(runs, 5, std::less<int>()), (std::vector<std::size_t>{ 4, 0, 1 }));
+}
+
+// lookup table baked in at compile time: squares mod 1009 of 0..N-1, sorted
+template<typename T, std::size_t N, typename Compare>
+constexpr std::array<T, N> sorted_residues(Compare comp) {
+    std::array<T, N> table{};
+    for (std::size_t i = 0; i < N; ++i) table[i] = static_cast<T>((i * i) % 1009);
+    qs::sort(table.data(), table.data() + N, comp, true);
+    return table;
+}
+
+template<typename T, std::size_t N, typename Compare>
+constexpr bool is_sorted_table(const std::array<T, N>& table, Compare comp) {
+    for (std::size_t i = 1; i < N; ++i) {
+        if (comp(table[i], table[i - 1])) return false;
+    }
+    return true;
+}
+
+TEST(ConstexprSort, SortsAtCompileTime) {
+    constexpr auto ints = sorted_residues<int, 2000>(std::less<>());
+    static_assert(is_sorted_table(ints, std::less<>()));
+    static_assert(ints.front() == 0 && ints.back() == 1008);
+
+    constexpr auto doubles = sorted_residues<double, 300>(std::greater<double>());
+    static_assert(is_sorted_table(doubles, std::greater<double>()));
+
+    constexpr auto few = sorted_residues<std::int64_t, 7>(std::less<std::int64_t>());
+    static_assert(is_sorted_table(few, std::less<>()));
+
+    // range overload and the sort-free helpers
+    constexpr auto by_range = [] {
+        std::array<unsigned, 40> table{};
+        for (unsigned i = 0; i < table.size(); ++i) table[i] = (i * 17) % 40;
+        qs::sort(table);
+        return table;
+    }();
+    static_assert(by_range[0] == 0 && by_range[39] == 39 && is_sorted_table(by_range, std::less<>()));
+
+    constexpr int median = [] {
+        int v[3] = { 7, 1, 4 };
+        return *qs::get_median_of_three(v, v + 1, v + 2, std::less<int>());
+    }();
+    static_assert(median == 4);
+
+    // the same table sorted at run time matches
+    std::vector<int> runtime(2000);
+    for (std::size_t i = 0; i < runtime.size(); ++i) runtime[i] = static_cast<int>((i * i) % 1009);
+    qs::sort(runtime);
+    EXPECT_TRUE(std::equal(runtime.begin(), runtime.end(), ints.begin(), ints.end()));
+}
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}